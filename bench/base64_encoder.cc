@@ -0,0 +1,31 @@
+#include <cstdint>
+
+#include "base64_encoder.hh"
+
+auto base64_encode(std::string_view input) -> std::string {
+    constexpr std::string_view alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string res;
+    res.reserve((input.size() + 2) / 3 * 4);
+    size_t i = 0;
+    for (; i + 3 <= input.size(); i += 3) {
+        const auto bits = (static_cast<std::uint32_t>(static_cast<unsigned char>(input[i])) << 16)
+                          | (static_cast<std::uint32_t>(static_cast<unsigned char>(input[i + 1])) << 8)
+                          | static_cast<std::uint32_t>(static_cast<unsigned char>(input[i + 2]));
+        res += alphabet[(bits >> 18) & 63];
+        res += alphabet[(bits >> 12) & 63];
+        res += alphabet[(bits >> 6) & 63];
+        res += alphabet[bits & 63];
+    }
+    const auto rest = input.size() - i;
+    if (rest != 0) {
+        auto bits = static_cast<std::uint32_t>(static_cast<unsigned char>(input[i])) << 16;
+        if (rest == 2) {
+            bits |= static_cast<std::uint32_t>(static_cast<unsigned char>(input[i + 1])) << 8;
+        }
+        res += alphabet[(bits >> 18) & 63];
+        res += alphabet[(bits >> 12) & 63];
+        res += (rest == 2) ? alphabet[(bits >> 6) & 63] : '=';
+        res += '=';
+    }
+    return res;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+// The client only ever decodes base64. The benchmarks and the fake server need to produce it.
+auto base64_encode(std::string_view input) -> std::string;
@@ -0,0 +1,620 @@
+// Stand-in for local_jira, speaking the same protocol on stdin/stdout, with synthetic tickets
+// and no database nor network. Used to benchmark the client end to end:
+//      jira_gui ./fake_jira_server --tickets=150000 --html-size=65536
+//      jira_gui_ipc_bench ./fake_jira_server --latency-us=200
+//
+// Every request gets an ACK, its RESULT if it has one, then FINISHED, in the order requests
+// come. Replies switch to binary frames when asked to. Once the client gave it a bulk channel,
+// binary frame payloads of --bulk-min-size bytes or more go through the shared ring while it
+// has room, and through the pipe otherwise.
+//
+// With --replay=<trace>, the server sends the replies of a recorded session instead (see
+// session_trace.hh), whatever the client asks for:
+//      jira_gui_replay ./fake_jira_server session.trace
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <expected>
+#include <format>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "bulk_channel.hh"
+#include "protocol.hh"
+#include "reply_framing.hh"
+#include "session_trace.hh"
+#include "utils.hh"
+
+#include "base64_encoder.hh"
+
+namespace {
+    struct workload {
+        size_t nr_tickets = 1000;
+        size_t nr_projects = 5;
+        size_t html_size = size_t{16} * 1024;
+        size_t nr_properties = 100;
+        size_t nr_attachments = 2; // per ticket
+        size_t attachment_size = size_t{256} * 1024;
+        // time spent on each request before its RESULT is sent, as if looking into the database
+        std::chrono::microseconds latency{0};
+        // after every burst_size requests, nothing is sent for burst_pause. 0 means no pause.
+        size_t burst_size = 0;
+        std::chrono::microseconds burst_pause{0};
+        // smaller payloads go through the pipe even with a bulk channel
+        size_t bulk_min_size = size_t{64} * 1024;
+    };
+
+    constexpr std::string_view usage =
+        "usage: fake_jira_server [options]\n"
+        "  --tickets=N            number of tickets (1000)\n"
+        "  --projects=N           number of projects they are spread over (5)\n"
+        "  --html-size=BYTES      size of each ticket page (16384)\n"
+        "  --properties=N         key/value properties per ticket (100)\n"
+        "  --attachments=N        attachments per ticket (2)\n"
+        "  --attachment-size=BYTES size of each attachment (262144)\n"
+        "  --latency-us=N         delay before each RESULT (0)\n"
+        "  --burst=N              pause after every N requests (0: never)\n"
+        "  --burst-pause-us=N     length of that pause (0)\n"
+        "  --bulk-min-size=BYTES  smallest payload sent through the bulk channel (65536)\n"
+        "or:    fake_jira_server --replay=TRACE [--original-pacing]\n"
+        "  --replay=TRACE         send the replies recorded in TRACE, as fast as possible\n"
+        "  --original-pacing      send them with the delays they were received with\n";
+
+    auto parse_size(std::string_view text) -> std::optional<size_t> {
+        size_t res = 0;
+        const auto [ptr, error] = std::from_chars(text.data(), text.data() + text.size(), res);
+        if ((error != std::errc{}) || (ptr != text.data() + text.size())) {
+            return std::nullopt;
+        }
+        return res;
+    }
+
+    auto parse_workload(std::span<const char* const> args) -> std::expected<workload, std::string> {
+        workload res;
+        for (const std::string_view arg : args) {
+            const auto equal_pos = arg.find('=');
+            if (!arg.starts_with("--") || (equal_pos == std::string_view::npos)) {
+                return std::unexpected(std::format("invalid argument {}", arg));
+            }
+            const auto name = arg.substr(2, equal_pos - 2);
+            const auto value = parse_size(arg.substr(equal_pos + 1));
+            if (!value.has_value()) {
+                return std::unexpected(std::format("invalid value for --{}", name));
+            }
+            if (name == "tickets") {
+                res.nr_tickets = *value;
+            } else if (name == "projects") {
+                res.nr_projects = std::max(*value, size_t{1});
+            } else if (name == "html-size") {
+                res.html_size = *value;
+            } else if (name == "properties") {
+                res.nr_properties = *value;
+            } else if (name == "attachments") {
+                res.nr_attachments = *value;
+            } else if (name == "attachment-size") {
+                res.attachment_size = *value;
+            } else if (name == "latency-us") {
+                res.latency = std::chrono::microseconds{*value};
+            } else if (name == "burst") {
+                res.burst_size = *value;
+            } else if (name == "burst-pause-us") {
+                res.burst_pause = std::chrono::microseconds{*value};
+            } else if (name == "bulk-min-size") {
+                res.bulk_min_size = std::max(*value, size_t{1});
+            } else {
+                return std::unexpected(std::format("unknown option --{}", name));
+            }
+        }
+        return res;
+    }
+
+    // Payload of a RESULT in both wire formats. Text lines need base64 where frames take the
+    // data as is.
+    struct payload {
+        std::string as_text;
+        std::string as_frame;
+    };
+
+    // key:value,key:value in text lines, alternating size prefixed fields in frames
+    class pair_list_builder {
+    public:
+        explicit pair_list_builder(bool is_key_base64_in_text)
+            : is_key_encoded(is_key_base64_in_text)
+        {
+        }
+
+        void add(std::string_view key, std::string_view value) {
+            if (!res.as_text.empty()) {
+                res.as_text += ',';
+            }
+            res.as_text += is_key_encoded ? base64_encode(key) : std::string(key);
+            res.as_text += ':';
+            res.as_text += base64_encode(value);
+            for (const auto field : {key, value}) {
+                append_le(res.as_frame, static_cast<std::uint32_t>(field.size()));
+                res.as_frame += field;
+            }
+        }
+
+        auto take() -> payload { return std::move(res); }
+
+    private:
+        bool is_key_encoded;
+        payload res = {};
+    };
+
+    auto binary_payload(std::string data) -> payload {
+        return { .as_text = base64_encode(data), .as_frame = std::move(data) };
+    }
+
+    auto ticket_key(const workload& load, size_t ticket_index) -> std::string {
+        return std::format("PRJ{}-{}", ticket_index % load.nr_projects, ticket_index / load.nr_projects + 1);
+    }
+
+    // Everything but the attachment lists is the same for all tickets: encoding them once keeps
+    // the server from being the bottleneck of the benchmarks.
+    struct canned_replies {
+        payload ticket_list;
+        payload ticket_page;
+        std::string ticket_page_hash; // as sent by FETCH_TICKET_IF_MODIFIED
+        payload properties;
+        payload attachment_content;
+    };
+
+    auto make_canned_replies(const workload& load) -> canned_replies {
+        std::string keys;
+        for (size_t i = 0; i < load.nr_tickets; ++i) {
+            if (i != 0) {
+                keys += ',';
+            }
+            keys += ticket_key(load, i);
+        }
+
+        std::string html = "<html><head></head><body><h1>Synthetic ticket</h1><p>";
+        constexpr std::string_view html_end = "</p></body></html>";
+        constexpr std::string_view filler = "Lorem ipsum dolor sit amet, consectetur adipiscing elit. ";
+        while (html.size() + html_end.size() < load.html_size) {
+            html += filler.substr(0, std::min(filler.size(), load.html_size - html.size() - html_end.size()));
+        }
+        html += html_end;
+
+        // a few values shared by all tickets, like statuses, and some unique ones
+        constexpr std::array<std::string_view, 4> statuses = {"Open", "In Progress", "In Review", "Closed"};
+        pair_list_builder properties(true);
+        for (size_t i = 0; i < load.nr_properties; ++i) {
+            const auto value = (i % 2 == 0) ? std::string(statuses[i % statuses.size()])
+                                            : std::format("Value of custom field number {}", i);
+            properties.add(std::format("customfield_{}", 10'000 + i), value);
+        }
+
+        std::string attachment(load.attachment_size, '\0');
+        for (size_t i = 0; i < attachment.size(); ++i) {
+            attachment[i] = static_cast<char>((i * 2654435761U) >> 24);
+        }
+
+        const auto page_hash = protocol::content_hash(std::span(reinterpret_cast<const std::uint8_t*>(html.data()), html.size()));
+        return {
+            .ticket_list = { .as_text = keys, .as_frame = keys }, // plain text in both formats
+            .ticket_page = binary_payload(std::move(html)),
+            .ticket_page_hash = protocol::content_hash_text(page_hash),
+            .properties = properties.take(),
+            .attachment_content = binary_payload(std::move(attachment)),
+        };
+    }
+
+    auto make_attachment_list(const workload& load, std::string_view ticket) -> payload {
+        pair_list_builder res(false);
+        for (size_t i = 0; i < load.nr_attachments; ++i) {
+            const auto uuid = std::format("{:08x}-0000-4000-8000-{:012x}", std::hash<std::string_view>{}(ticket) & 0xFFFF'FFFF, i);
+            res.add(uuid, std::format("attachment_{}.bin", i));
+        }
+        return res.take();
+    }
+
+    // Server side of the bulk channel: the client's ring, mapped from the fd it was inherited as.
+    // Payloads are written where bulk_channel.hh says, after the previous one, never wrapping
+    // around, and only below the position the client released + capacity.
+    class bulk_ring {
+    public:
+        static auto try_open(int fd) -> std::expected<std::unique_ptr<bulk_ring>, std::string> {
+            struct stat file_stat = {};
+            if (fstat(fd, &file_stat) == -1) {
+                return std::unexpected(std::format("invalid bulk channel fd {}. Err is {}: {}", fd, errno, strerror(errno)));
+            }
+            const auto file_size = static_cast<size_t>(file_stat.st_size);
+            if (file_size <= bulk_channel::data_offset) {
+                return std::unexpected(std::format("bulk channel of {} bytes is too small", file_size));
+            }
+            auto* const mapping = mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (mapping == MAP_FAILED) {
+                return std::unexpected(std::format("failed to map the bulk channel. Err is {}: {}", errno, strerror(errno)));
+            }
+            auto* const control = static_cast<bulk_channel::control_block*>(mapping);
+            if (control->capacity != file_size - bulk_channel::data_offset) {
+                munmap(mapping, file_size);
+                return std::unexpected(std::format("bulk channel capacity {} doesn't match its size {}", control->capacity, file_size));
+            }
+            return std::unique_ptr<bulk_ring>(new bulk_ring(mapping, control));
+        }
+
+        bulk_ring(const bulk_ring&) = delete;
+        bulk_ring& operator=(const bulk_ring&) = delete;
+        ~bulk_ring() noexcept {
+            munmap(mapping, bulk_channel::data_offset + capacity);
+        }
+
+        // nullopt when the client didn't release enough of the ring yet
+        auto write(std::string_view data) -> std::optional<bulk_descriptor> {
+            const auto size = std::uint64_t{data.size()};
+            if (size > capacity) {
+                return std::nullopt;
+            }
+            auto position = next_position;
+            if ((position % capacity) + size > capacity) {
+                position += capacity - (position % capacity);
+            }
+            if (position + size > control->released_position.load(std::memory_order_acquire) + capacity) {
+                return std::nullopt;
+            }
+            std::memcpy(data_area + (position % capacity), data.data(), data.size());
+            next_position = position + size;
+            return bulk_descriptor{ .position = position, .size = size };
+        }
+
+    private:
+        bulk_ring(void* ring_mapping, bulk_channel::control_block* ring_control) noexcept
+            : mapping(ring_mapping)
+            , control(ring_control)
+            , data_area(static_cast<std::uint8_t*>(ring_mapping) + bulk_channel::data_offset)
+            , capacity(ring_control->capacity)
+        {
+        }
+
+        void* mapping;
+        bulk_channel::control_block* control; // start of mapping
+        std::uint8_t* data_area;
+        std::uint64_t capacity;
+        std::uint64_t next_position = 0;
+    };
+
+    class reply_writer {
+    public:
+        void set_format(wire_format new_format) { format = new_format; }
+        void set_bulk_ring(std::unique_ptr<bulk_ring> ring, size_t min_size) {
+            bulk = std::move(ring);
+            bulk_min_size = min_size;
+        }
+        auto nr_pending_bytes() const noexcept -> size_t { return pending.size(); }
+
+        void add(std::string_view request_id, reply_kind kind, const payload& data) {
+            if ((format == wire_format::binary_frames) && (bulk != nullptr) && (data.as_frame.size() >= bulk_min_size)) {
+                if (const auto descriptor = bulk->write(data.as_frame); descriptor.has_value()) {
+                    std::string bulk_payload;
+                    append_le<std::uint64_t>(bulk_payload, descriptor->position);
+                    append_le<std::uint64_t>(bulk_payload, descriptor->size);
+                    add_frame(request_id, static_cast<std::uint8_t>(kind) | frame_header::bulk_flag, bulk_payload);
+                    return;
+                }
+            }
+            add(request_id, kind, (format == wire_format::text_lines) ? data.as_text : data.as_frame);
+        }
+
+        // data must be already encoded for the current format
+        void add(std::string_view request_id, reply_kind kind, std::string_view data = {}) {
+            if (format == wire_format::text_lines) {
+                pending += request_id;
+                pending += ' ';
+                pending += kind_word(kind);
+                if (!data.empty()) {
+                    pending += ' ';
+                    pending += data;
+                }
+                pending += '\n';
+                return;
+            }
+            add_frame(request_id, static_cast<std::uint8_t>(kind), data);
+        }
+
+        // blocks until everything is written
+        auto flush() -> bool {
+            const auto written = write_all(STDOUT_FILENO, std::span(reinterpret_cast<const std::uint8_t*>(pending.data()), pending.size()));
+            pending.clear();
+            return written.has_value();
+        }
+
+    private:
+        void add_frame(std::string_view request_id, std::uint8_t kind_byte, std::string_view data) {
+            pending += frame_header::magic[0];
+            pending += frame_header::magic[1];
+            pending += static_cast<char>(frame_header::version);
+            pending += static_cast<char>(kind_byte);
+            append_le(pending, static_cast<std::uint32_t>(request_id.size()));
+            append_le<std::uint64_t>(pending, data.size());
+            pending += request_id;
+            pending += data;
+        }
+
+        static auto kind_word(reply_kind kind) -> std::string_view {
+            switch (kind) {
+                case reply_kind::ack:
+                    return "ACK";
+                case reply_kind::result:
+                    return "RESULT";
+                case reply_kind::error:
+                    return "ERROR";
+                case reply_kind::finished:
+                    return "FINISHED";
+                case reply_kind::not_modified:
+                    return "NOT_MODIFIED";
+            }
+            return "ERROR";
+        }
+
+        wire_format format = wire_format::text_lines;
+        std::unique_ptr<bulk_ring> bulk = nullptr;
+        size_t bulk_min_size = 0;
+        std::string pending = {};
+    };
+
+    struct request {
+        std::string_view id;
+        std::string_view verb;
+        std::string_view arguments; // comma separated
+    };
+
+    auto parse_request(std::string_view line) -> std::optional<request> {
+        const auto id_end = line.find(' ');
+        if ((id_end == std::string_view::npos) || (id_end == 0)) {
+            return std::nullopt;
+        }
+        const auto rest = line.substr(id_end + 1);
+        const auto verb_end = rest.find(' ');
+        return request{
+            .id = line.substr(0, id_end),
+            .verb = rest.substr(0, verb_end),
+            .arguments = (verb_end == std::string_view::npos) ? std::string_view{} : rest.substr(verb_end + 1),
+        };
+    }
+
+    // returns false when the server must exit
+    auto handle(const request& req, const workload& load, const canned_replies& canned, reply_writer& out) -> bool {
+        const auto first_argument = req.arguments.substr(0, req.arguments.find(','));
+        const auto send_result = [&](const payload& data) {
+            out.add(req.id, reply_kind::ack);
+            if (load.latency.count() != 0) {
+                // the client sees the ACK right away, like with local_jira
+                out.flush();
+                std::this_thread::sleep_for(load.latency);
+            }
+            out.add(req.id, reply_kind::result, data);
+            out.add(req.id, reply_kind::finished);
+        };
+        const auto send_done = [&]() {
+            out.add(req.id, reply_kind::ack);
+            out.add(req.id, reply_kind::finished);
+        };
+
+        if (req.verb == protocol::exit_server_now::verb) {
+            return false;
+        }
+        if (req.verb == protocol::fetch_ticket_list::verb) {
+            send_result(canned.ticket_list);
+        } else if (req.verb == protocol::fetch_ticket::verb) {
+            send_result(canned.ticket_page);
+        } else if (req.verb == protocol::fetch_ticket_if_modified::verb) {
+            // every ticket has the same page, which never changes
+            const auto known_hash = req.arguments.substr(req.arguments.rfind(',') + 1);
+            if (known_hash == canned.ticket_page_hash) {
+                out.add(req.id, reply_kind::ack);
+                out.add(req.id, reply_kind::not_modified);
+                out.add(req.id, reply_kind::finished);
+            } else {
+                send_result(canned.ticket_page);
+            }
+        } else if (req.verb == protocol::fetch_ticket_key_value_fields::verb) {
+            send_result(canned.properties);
+        } else if (req.verb == protocol::fetch_attachment_list_for_ticket::verb) {
+            send_result(make_attachment_list(load, first_argument));
+        } else if (req.verb == protocol::fetch_attachment_content::verb) {
+            send_result(canned.attachment_content);
+        } else if ((req.verb == protocol::synchronise_updated::verb) || (req.verb == protocol::synchronise_all::verb)) {
+            send_done();
+        } else if (req.verb == protocol::cancel::verb) {
+            // requests are handled in order, the cancelled one already got its FINISHED
+            send_done();
+        } else if ((req.verb == protocol::set_reply_format::verb) && (first_argument == "BINARY_FRAMES")) {
+            // the ACK is the last text line
+            out.add(req.id, reply_kind::ack);
+            out.set_format(wire_format::binary_frames);
+        } else if (req.verb == protocol::enable_bulk_channel::verb) {
+            const auto fd = parse_size(first_argument);
+            auto ring = fd.has_value() ? bulk_ring::try_open(static_cast<int>(*fd))
+                                       : std::unexpected(std::format("invalid bulk channel fd {}", first_argument));
+            if (ring.has_value()) {
+                out.set_bulk_ring(std::move(ring.value()), load.bulk_min_size);
+                send_done();
+            } else {
+                out.add(req.id, reply_kind::error, ring.error());
+            }
+        } else {
+            // also for priority hints, which aren't supported
+            out.add(req.id, reply_kind::error, std::format("unsupported request {}", req.verb));
+        }
+        return true;
+    }
+    // reads stdin until input holds a whole line, then removes it from input and returns it
+    // without its '\n'. nullopt once stdin can't be read anymore.
+    auto read_line(std::string& input) -> std::optional<std::string> {
+        std::array<char, 4096> buffer;
+        auto line_end = input.find('\n');
+        while (line_end == std::string::npos) {
+            const auto nr_read = read(STDIN_FILENO, buffer.data(), buffer.size());
+            if (nr_read == 0) {
+                return std::nullopt;
+            }
+            if (nr_read < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return std::nullopt;
+            }
+            input.append(buffer.data(), static_cast<size_t>(nr_read));
+            line_end = input.find('\n');
+        }
+        auto res = input.substr(0, line_end);
+        input.erase(0, line_end + 1);
+        return res;
+    }
+
+    // Sends the replies of trace in the wire format they were recorded in. Requests are only
+    // looked at to switch to binary frames and to exit.
+    auto replay(const session_trace& trace, bool original_pacing) -> int {
+        // written in big chunks, unless waiting for the next reply anyway
+        constexpr size_t max_nr_pending_bytes = size_t{1024} * 1024;
+
+        reply_writer out;
+        std::string input;
+        const auto recorded_with_frames = !trace.replies.empty() && (trace.replies.front().msg.encoding == payload_encoding::raw_bytes);
+        if (recorded_with_frames) {
+            // the client must ask for binary frames first, the ACK being the last text line
+            while (true) {
+                const auto line = read_line(input);
+                if (!line.has_value()) {
+                    return 0;
+                }
+                const auto req = parse_request(line.value());
+                if (!req.has_value()) {
+                    continue;
+                }
+                if (req->verb == protocol::exit_server_now::verb) {
+                    return 0;
+                }
+                if (req->verb == protocol::set_reply_format::verb) {
+                    out.add(req->id, reply_kind::ack);
+                    out.set_format(wire_format::binary_frames);
+                    break;
+                }
+            }
+        }
+
+        // the replies don't depend on the requests, only exiting does
+        std::jthread exit_watcher([input = std::move(input)]() mutable {
+            while (true) {
+                const auto line = read_line(input);
+                if (!line.has_value()) {
+                    std::_Exit(0);
+                }
+                const auto req = parse_request(line.value());
+                if (req.has_value() && (req->verb == protocol::exit_server_now::verb)) {
+                    std::_Exit(0);
+                }
+            }
+        });
+
+        const auto start = std::chrono::steady_clock::now();
+        const auto first_reply_time = trace.replies.empty() ? std::chrono::nanoseconds{0} : trace.replies.front().time;
+        for (const auto& reply : trace.replies) {
+            if (original_pacing) {
+                const auto send_time = start + (reply.time - first_reply_time);
+                if (send_time > std::chrono::steady_clock::now()) {
+                    if (!out.flush()) {
+                        return 3;
+                    }
+                    std::this_thread::sleep_until(send_time);
+                }
+            }
+            out.add(reply.msg.request_id, reply.msg.kind, reply.msg.payload.as_string_view());
+            if ((out.nr_pending_bytes() >= max_nr_pending_bytes) && !out.flush()) {
+                return 3;
+            }
+        }
+        if (!out.flush()) {
+            return 3;
+        }
+        // like local_jira, stays until the client asks to exit
+        exit_watcher.join();
+        return 0;
+    }
+} // namespace
+
+int main(int argc, char* argv[]) {
+    if ((argc >= 2) && std::string_view(argv[1]).starts_with("--replay=")) {
+        const auto original_pacing = (argc == 3) && (std::string_view(argv[2]) == "--original-pacing");
+        if ((argc > 3) || ((argc == 3) && !original_pacing)) {
+            std::cerr << std::format("Error: invalid arguments\n{}", usage);
+            return 1;
+        }
+        const auto trace = read_session_trace(std::string(std::string_view(argv[1]).substr(std::string_view("--replay=").size())));
+        if (!trace.has_value()) {
+            std::cerr << std::format("Error: {}\n", trace.error());
+            return 1;
+        }
+        return replay(trace.value(), original_pacing);
+    }
+
+    const auto load = parse_workload(std::span<const char* const>(argv + 1, static_cast<size_t>(std::max(argc - 1, 0))));
+    if (!load.has_value()) {
+        std::cerr << std::format("Error: {}\n{}", load.error(), usage);
+        return 1;
+    }
+    const auto canned = make_canned_replies(load.value());
+
+    reply_writer out;
+    std::string input;
+    size_t nr_requests = 0;
+    std::array<char, 64 * 1024> buffer;
+    while (true) {
+        const auto nr_read = read(STDIN_FILENO, buffer.data(), buffer.size());
+        if (nr_read == 0) {
+            return 0;
+        }
+        if (nr_read < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 2;
+        }
+        input.append(buffer.data(), static_cast<size_t>(nr_read));
+
+        size_t line_begin = 0;
+        for (auto line_end = input.find('\n'); line_end != std::string::npos; line_end = input.find('\n', line_begin)) {
+            const auto line = std::string_view(input).substr(line_begin, line_end - line_begin);
+            line_begin = line_end + 1;
+            const auto req = parse_request(line);
+            if (!req.has_value()) {
+                continue;
+            }
+            if (!handle(req.value(), load.value(), canned, out)) {
+                out.flush();
+                return 0;
+            }
+            ++nr_requests;
+            if ((load->burst_size != 0) && (nr_requests % load->burst_size == 0)) {
+                out.flush();
+                std::this_thread::sleep_for(load->burst_pause);
+            }
+        }
+        input.erase(0, line_begin);
+        // replies to everything read so far go out together
+        if (!out.flush()) {
+            return 3;
+        }
+    }
+}
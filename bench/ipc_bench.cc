@@ -0,0 +1,284 @@
+// End to end benchmark of the requests going through ProgHandler to a server and back:
+// request queue, writer thread, pipe, reader thread and reply framing. Meant to be run
+// against fake_jira_server, so it needs neither network nor jira:
+//      jira_gui_ipc_bench [--text] [--no-bulk] [--requests=N] [--in-flight=N] <server> [server arguments...]
+//
+// For each kind of request, reports throughput and latency (request queued to FINISHED
+// received) with a single request in flight, then with --in-flight requests in flight.
+// With binary frames, big payloads come through the bulk channel unless --no-bulk is given.
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <format>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "prog_handler.hh"
+#include "protocol.hh"
+#include "request_router.hh"
+
+namespace {
+    using bench_clock = std::chrono::steady_clock;
+
+    struct options {
+        wire_format format = wire_format::binary_frames;
+        bool use_bulk_channel = true;
+        size_t nr_requests = 2000;
+        size_t max_in_flight = 32;
+        const char* server = nullptr;
+        std::span<const char* const> server_args = {};
+    };
+
+    auto parse_options(int argc, char* argv[]) -> std::optional<options> {
+        options res;
+        int i = 1;
+        const auto parse_number = [](std::string_view text) -> std::optional<size_t> {
+            size_t value = 0;
+            const auto [ptr, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+            if ((error != std::errc{}) || (ptr != text.data() + text.size()) || (value == 0)) {
+                return std::nullopt;
+            }
+            return value;
+        };
+        for (; (i < argc) && std::string_view(argv[i]).starts_with("--"); ++i) {
+            const std::string_view arg = argv[i];
+            if (arg == "--text") {
+                res.format = wire_format::text_lines;
+            } else if (arg == "--no-bulk") {
+                res.use_bulk_channel = false;
+            } else if (arg.starts_with("--requests=")) {
+                const auto value = parse_number(arg.substr(arg.find('=') + 1));
+                if (!value.has_value()) {
+                    return std::nullopt;
+                }
+                res.nr_requests = *value;
+            } else if (arg.starts_with("--in-flight=")) {
+                const auto value = parse_number(arg.substr(arg.find('=') + 1));
+                if (!value.has_value()) {
+                    return std::nullopt;
+                }
+                res.max_in_flight = *value;
+            } else {
+                return std::nullopt;
+            }
+        }
+        if (i >= argc) {
+            return std::nullopt;
+        }
+        res.server = argv[i];
+        res.server_args = std::span<const char* const>(argv + i + 1, static_cast<size_t>(argc - i - 1));
+        return res;
+    }
+
+    // Requests in flight and measures about the finished ones. Updated by the reader thread.
+    class request_tracker {
+    public:
+        void sent(std::uint64_t request_number) {
+            const std::lock_guard lock(mutex);
+            in_flight.emplace(request_number, bench_clock::now());
+        }
+
+        void on_reply(const server_message& msg) {
+            const auto request_number = parse_request_number(msg.request_id);
+            if (!request_number.has_value()) {
+                return;
+            }
+            const std::lock_guard lock(mutex);
+            if (msg.kind == reply_kind::result) {
+                nr_payload_bytes += msg.payload.size();
+                if (keep_payload) {
+                    last_payload = std::string(msg.payload.as_string_view());
+                }
+                return;
+            }
+            if ((msg.kind != reply_kind::finished) && (msg.kind != reply_kind::error)) {
+                return;
+            }
+            if (msg.kind == reply_kind::error) {
+                ++nr_errors;
+            }
+            const auto it = in_flight.find(request_number.value());
+            if (it == in_flight.end()) {
+                return;
+            }
+            latencies.push_back(bench_clock::now() - it->second);
+            in_flight.erase(it);
+            done.notify_all();
+        }
+
+        void wait_until_fewer_in_flight_than(size_t max_in_flight) {
+            std::unique_lock lock(mutex);
+            done.wait(lock, [&]() { return in_flight.size() < max_in_flight; });
+        }
+
+        struct measures {
+            std::vector<bench_clock::duration> latencies;
+            size_t nr_payload_bytes;
+            size_t nr_errors;
+            std::string last_payload;
+        };
+
+        auto take_measures() -> measures {
+            const std::lock_guard lock(mutex);
+            auto res = measures{ .latencies = std::move(latencies), .nr_payload_bytes = nr_payload_bytes,
+                                 .nr_errors = nr_errors, .last_payload = std::move(last_payload) };
+            latencies = {};
+            nr_payload_bytes = 0;
+            nr_errors = 0;
+            last_payload = {};
+            return res;
+        }
+
+        void set_keep_payload(bool keep) {
+            const std::lock_guard lock(mutex);
+            keep_payload = keep;
+        }
+
+    private:
+        std::mutex mutex = {};
+        std::condition_variable done = {};
+        std::unordered_map<std::uint64_t, bench_clock::time_point> in_flight = {};
+        std::vector<bench_clock::duration> latencies = {};
+        size_t nr_payload_bytes = 0;
+        size_t nr_errors = 0;
+        bool keep_payload = false;
+        std::string last_payload = {};
+    };
+
+    auto percentile(std::span<const bench_clock::duration> sorted, double fraction) -> double {
+        const auto index = std::min(static_cast<size_t>(fraction * static_cast<double>(sorted.size())), sorted.size() - 1);
+        return std::chrono::duration<double, std::micro>(sorted[index]).count();
+    }
+
+    class bench_session {
+    public:
+        bench_session(ProgHandler& server_handler, request_tracker& request_tracker)
+            : server(server_handler)
+            , tracker(request_tracker)
+        {
+        }
+
+        // Sends nr_requests requests made by make_request(request_number), keeping at most
+        // max_in_flight of them in flight, and waits for all of them to finish.
+        template <typename MakeRequest>
+        auto run(std::string_view name, size_t nr_requests, size_t max_in_flight, MakeRequest make_request) -> request_tracker::measures {
+            const auto start = bench_clock::now();
+            for (size_t i = 0; i < nr_requests; ++i) {
+                tracker.wait_until_fewer_in_flight_than(max_in_flight);
+                const auto request_number = next_request_number++;
+                auto request = make_request(request_number);
+                tracker.sent(request_number);
+                auto queued = server.queue_request(std::string(protocol::get_request_id(request)), std::move(request));
+                if (!queued.has_value()) {
+                    std::cout << std::format("Error: failed to queue a request: {}\n", queued.error());
+                    return tracker.take_measures();
+                }
+            }
+            tracker.wait_until_fewer_in_flight_than(1);
+            const auto elapsed = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+            auto measures = tracker.take_measures();
+            std::ranges::sort(measures.latencies);
+            std::cout << std::format("{:<40} {:>4} in flight {:>10.0f} req/s {:>10.1f} MiB/s   latency us: p50 {:>8.1f} p99 {:>8.1f} max {:>8.1f}{}\n",
+                                     name, max_in_flight,
+                                     static_cast<double>(nr_requests) / elapsed,
+                                     static_cast<double>(measures.nr_payload_bytes) / (1024.0 * 1024.0) / elapsed,
+                                     percentile(measures.latencies, 0.5), percentile(measures.latencies, 0.99),
+                                     percentile(measures.latencies, 1.0),
+                                     (measures.nr_errors == 0) ? std::string() : std::format(" ({} errors)", measures.nr_errors));
+            return measures;
+        }
+
+        // ticket keys known by the server
+        auto fetch_ticket_keys() -> std::vector<std::string> {
+            tracker.set_keep_payload(true);
+            const auto measures = run("FETCH_TICKET_LIST", 1, 1, [](std::uint64_t request_number) {
+                return protocol::make_request({"bench-ticket-list", request_number}, protocol::fetch_ticket_list{});
+            });
+            tracker.set_keep_payload(false);
+            // the ticket list is plain text in both wire formats
+            const auto& list = measures.last_payload;
+            std::vector<std::string> res;
+            for (const auto key : std::views::split(std::string_view(list), ',')) {
+                res.emplace_back(std::string_view(key));
+            }
+            return res;
+        }
+
+    private:
+        ProgHandler& server;
+        request_tracker& tracker;
+        std::uint64_t next_request_number = 1;
+    };
+} // namespace
+
+int main(int argc, char* argv[]) {
+    const auto opts = parse_options(argc, argv);
+    if (!opts.has_value()) {
+        std::cout << "usage: jira_gui_ipc_bench [--text] [--no-bulk] [--requests=N] [--in-flight=N] <server> [server arguments...]\n";
+        return 1;
+    }
+    if (!set_sigpipe_signal_handler()) {
+        return 4;
+    }
+    auto server = ProgHandler::try_new(opts->server, opts->server_args);
+    if (!server.has_value()) {
+        std::cout << std::format("Error: failed to start the server: {}\n", server.error());
+        return 5;
+    }
+
+    request_tracker tracker;
+    auto reader = server->start_background_message_listener(
+        [&](server_message msg) { tracker.on_reply(msg); },
+        [](std::string error) { std::cout << std::format("Error: {}", error); },
+        ProgHandler::listener_options{ .preferred_format = opts->format, .use_bulk_channel = opts->use_bulk_channel });
+    auto writer = server->start_background_request_writer([](std::string request_id, std::string reason) {
+        std::cout << std::format("Error: failed to send {}: {}\n", request_id, reason);
+    });
+    if (!reader.has_value() || !writer.has_value()) {
+        std::cout << "Error: failed to start the threads talking to the server\n";
+        return 5;
+    }
+
+    bench_session session(server.value(), tracker);
+    const auto keys = session.fetch_ticket_keys();
+    if (keys.empty()) {
+        std::cout << "Error: the server has no ticket\n";
+        return 6;
+    }
+    const auto key_of = [&](std::uint64_t request_number) -> std::string_view { return keys[request_number % keys.size()]; };
+
+    for (const auto in_flight : {size_t{1}, opts->max_in_flight}) {
+        session.run("FETCH_TICKET", opts->nr_requests, in_flight, [&](std::uint64_t request_number) {
+            return protocol::make_request({"bench-fetch-html", request_number}, protocol::fetch_ticket{key_of(request_number)});
+        });
+        session.run("FETCH_TICKET_KEY_VALUE_FIELDS", opts->nr_requests, in_flight, [&](std::uint64_t request_number) {
+            return protocol::make_request({"bench-fetch-properties", request_number}, protocol::fetch_ticket_key_value_fields{key_of(request_number)});
+        });
+        session.run("FETCH_ATTACHMENT_LIST_FOR_TICKET", opts->nr_requests, in_flight, [&](std::uint64_t request_number) {
+            return protocol::make_request({"bench-fetch-attachments", request_number}, protocol::fetch_attachment_list_for_ticket{key_of(request_number)});
+        });
+        session.run("FETCH_ATTACHMENT_CONTENT", opts->nr_requests, in_flight, [&](std::uint64_t request_number) {
+            return protocol::make_request({"bench-fetch-attachment", request_number}, protocol::fetch_attachment_content{"00000000-0000-4000-8000-000000000000"});
+        });
+    }
+
+    // same shutdown sequence as jira_gui
+    writer->request_stop();
+    writer->join();
+    reader->request_stop();
+    server->send_to_child(protocol::make_request({"exit-immediately"}, protocol::exit_server_now{}));
+    server->kill_child_after_timeout(std::chrono::milliseconds{500});
+    reader->join();
+    return 0;
+}
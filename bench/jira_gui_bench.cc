@@ -0,0 +1,390 @@
+// Microbenchmarks for the hot paths between the server and the window: base64 decoding,
+// sorting the issue list, decoding key/value replies, dispatching replies and the view cache.
+// Inputs are synthetic but shaped like real replies, at increasing sizes.
+//
+// usage: jira_gui_bench [filter]
+// Only benchmarks whose name contains filter are run.
+//
+// usage: jira_gui_bench --check
+// Checks the vectorised base64 decoders against the scalar one instead, and fails if they
+// disagree. To be run after changing any of them.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <format>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <random>
+#include <ranges>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <poll.h>
+
+#include "decode_pipeline.hh"
+#include "issue_keys.hh"
+#include "lru_cache.hh"
+#include "protocol.hh"
+#include "reply_arena.hh"
+#include "reply_channel.hh"
+#include "request_router.hh"
+#include "utils.hh"
+
+#include "base64_encoder.hh"
+
+// Every allocation of the program goes through these, so the benchmarks can report how many
+// allocations an operation does.
+namespace {
+    std::atomic<std::uint64_t> nr_allocations = 0;
+
+    auto counted_allocation(size_t nr_bytes, std::align_val_t alignment) -> void* {
+        nr_allocations.fetch_add(1, std::memory_order_relaxed);
+        const auto align = std::max(static_cast<size_t>(alignment), alignof(std::max_align_t));
+        // aligned_alloc wants a size multiple of the alignment
+        void* const res = std::aligned_alloc(align, std::max((nr_bytes + align - 1) / align * align, align));
+        if (res == nullptr) {
+            throw std::bad_alloc();
+        }
+        return res;
+    }
+} // namespace
+
+auto operator new(size_t nr_bytes) -> void* {
+    return counted_allocation(nr_bytes, std::align_val_t{alignof(std::max_align_t)});
+}
+
+auto operator new(size_t nr_bytes, std::align_val_t alignment) -> void* {
+    return counted_allocation(nr_bytes, alignment);
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept {
+    std::free(ptr);
+}
+
+namespace {
+    // keeps the compiler from optimising away a result nobody reads
+    template <typename T>
+    void keep(const T& value) {
+        asm volatile("" : : "g"(&value) : "memory");
+    }
+
+    // Runs op until at least min_duration elapsed, then prints the time, the throughput over
+    // nr_bytes (when not 0) and the number of allocations, all per call of op.
+    template <typename Op>
+    void run(std::string_view filter, std::string_view name, size_t nr_bytes, Op&& op) {
+        if (!name.contains(filter)) {
+            return;
+        }
+        constexpr auto min_duration = std::chrono::milliseconds{200};
+        op(); // warm up caches, lazily initialised tables and the cpu dispatch
+
+        std::uint64_t nr_runs = 0;
+        const auto allocations_before = nr_allocations.load(std::memory_order_relaxed);
+        const auto start = std::chrono::steady_clock::now();
+        auto elapsed = std::chrono::steady_clock::duration{};
+        do {
+            op();
+            ++nr_runs;
+            elapsed = std::chrono::steady_clock::now() - start;
+        } while (elapsed < min_duration);
+        const auto nr_allocs = nr_allocations.load(std::memory_order_relaxed) - allocations_before;
+
+        const auto ns_per_op = std::chrono::duration<double, std::nano>(elapsed).count() / static_cast<double>(nr_runs);
+        const auto throughput = (nr_bytes == 0)
+            ? std::string("-")
+            : std::format("{:.1f} MiB/s", static_cast<double>(nr_bytes) / (1024.0 * 1024.0) / (ns_per_op * 1e-9));
+        std::cout << std::format("{:<48} {:>14.1f} ns/op {:>16} {:>10.1f} allocs/op\n",
+                                 name, ns_per_op, throughput,
+                                 static_cast<double>(nr_allocs) / static_cast<double>(nr_runs));
+    }
+
+    auto make_message(std::string request_id, reply_kind kind, payload_encoding encoding, std::string payload) -> server_message {
+        auto owner = std::make_shared<const std::string>(std::move(payload));
+        const auto* data = reinterpret_cast<const std::uint8_t*>(owner->data());
+        const auto size = owner->size();
+        return {
+            .request_id = std::move(request_id),
+            .kind = kind,
+            .encoding = encoding,
+            .payload = byte_slice(std::move(owner), data, size),
+        };
+    }
+
+    void bench_base64(std::string_view filter, std::mt19937_64& rng) {
+        for (const size_t nr_bytes : {size_t{64}, size_t{4} * 1024, size_t{256} * 1024, size_t{16} * 1024 * 1024}) {
+            std::string raw(nr_bytes, '\0');
+            std::ranges::generate(raw, [&]() { return static_cast<char>(rng()); });
+            const auto encoded = base64_encode(raw);
+
+            run(filter, std::format("base64_decode/{}", nr_bytes), encoded.size(), [&]() {
+                auto res = base64_decode(encoded);
+                keep(res);
+            });
+            std::vector<std::uint8_t> dest(base64_decoded_size(encoded));
+            run(filter, std::format("base64_decode_into/{}", nr_bytes), encoded.size(), [&]() {
+                auto res = base64_decode_into(encoded, dest);
+                keep(res);
+            });
+        }
+    }
+
+    // keys spread over a few projects, the way an issue list reply looks like
+    auto make_issue_keys(size_t nr_keys, std::mt19937_64& rng) -> std::vector<std::string> {
+        constexpr size_t nr_projects = 20;
+        std::vector<std::string> res;
+        res.reserve(nr_keys);
+        for (size_t i = 0; i < nr_keys; ++i) {
+            res.push_back(std::format("PRJ{}-{}", rng() % nr_projects, rng() % (nr_keys / nr_projects + 1) * 3 + 1));
+        }
+        return res;
+    }
+
+    void bench_issue_sort(std::string_view filter, std::mt19937_64& rng) {
+        for (const size_t nr_keys : {size_t{1000}, size_t{10'000}, size_t{150'000}}) {
+            const auto keys = make_issue_keys(nr_keys, rng);
+            const std::vector<std::string_view> views(keys.begin(), keys.end());
+
+            // copying the views is part of the measure, it is small compared to sorting
+            run(filter, std::format("sort_is_issue_before/{}", nr_keys), 0, [&]() {
+                auto to_sort = views;
+                std::ranges::sort(to_sort, [](std::string_view a, std::string_view b) { return is_issue_before(a, b); });
+                keep(to_sort);
+            });
+            run(filter, std::format("sorted_issue_order/{}", nr_keys), 0, [&]() {
+                auto order = sorted_issue_order(views);
+                keep(order);
+            });
+        }
+    }
+
+    // base64 encoded key:value pairs, like FETCH_TICKET_KEY_VALUE_FIELDS replies
+    auto make_properties_reply(size_t nr_fields) -> server_message {
+        std::string payload;
+        for (size_t i = 0; i < nr_fields; ++i) {
+            if (i != 0) {
+                payload += ',';
+            }
+            payload += base64_encode(std::format("customfield_{}", 10'000 + i));
+            payload += ':';
+            payload += base64_encode(std::format("Value of the custom field number {}, with a bit of text", i));
+        }
+        return make_message("PRJ-1-fetch-key-value-list-3", reply_kind::result, payload_encoding::base64_text, std::move(payload));
+    }
+
+    void bench_properties_decode(std::string_view filter) {
+        for (const size_t nr_fields : {size_t{10}, size_t{100}, size_t{1000}}) {
+            const auto msg = make_properties_reply(nr_fields);
+            run(filter, std::format("ticket_properties::decode/{}", nr_fields), msg.payload.size(), [&]() {
+                auto res = protocol::ticket_properties::decode(msg);
+                keep(res);
+            });
+            run(filter, std::format("ticket_properties::decode/arena/{}", nr_fields), msg.payload.size(), [&]() {
+                reply_arena arena(msg.payload.size() + 4096);
+                auto res = protocol::ticket_properties::decode(msg, &arena);
+                keep(res);
+            });
+            // like the decode workers do for small replies
+            std::vector<std::byte> block(size_t{64} * 1024);
+            reply_arena reused_arena(block);
+            run(filter, std::format("ticket_properties::decode/reused_arena/{}", nr_fields), msg.payload.size(), [&]() {
+                reused_arena.reset();
+                auto res = protocol::ticket_properties::decode(msg, &reused_arena);
+                keep(res);
+            });
+        }
+    }
+
+    void bench_router_dispatch(std::string_view filter) {
+        for (const std::uint64_t nr_pending : {std::uint64_t{10}, std::uint64_t{1000}}) {
+            request_router router;
+            size_t nr_handled = 0;
+            for (std::uint64_t i = 1; i <= nr_pending; ++i) {
+                router.add(i, [&](decoded_reply&) noexcept { ++nr_handled; }, [](const std::string&) noexcept {});
+            }
+            std::vector<decoded_reply> replies;
+            for (std::uint64_t i = 1; i <= nr_pending; ++i) {
+                replies.push_back({ .msg = make_message(std::format("PRJ-{}-fetch-html-{}", i, i), reply_kind::result,
+                                                        payload_encoding::raw_bytes, "<html></html>") });
+            }
+            std::uint64_t next = 0;
+            run(filter, std::format("request_router::dispatch/{}", nr_pending), 0, [&]() {
+                router.dispatch(replies[next]);
+                next = (next + 1) % nr_pending;
+            });
+            keep(nr_handled);
+        }
+    }
+
+    // lookups in a cache holding nr_entries ticket pages, a page being looked up by its key,
+    // then a page missing from it
+    void bench_view_cache(std::string_view filter, std::mt19937_64& rng) {
+        for (const size_t nr_entries : {size_t{100}, size_t{10'000}}) {
+            constexpr size_t page_size = 16 * 1024;
+            lru_cache<std::string> cache(nr_entries * page_size);
+            const auto keys = make_issue_keys(nr_entries, rng);
+            for (const auto& key : keys) {
+                cache.insert(std::format("0:{}", key), std::string(page_size, 'x'), page_size);
+            }
+            std::vector<std::string> lookups;
+            for (size_t i = 0; i < 1024; ++i) {
+                lookups.push_back(std::format("0:{}", keys[rng() % keys.size()]));
+            }
+            size_t next = 0;
+            run(filter, std::format("lru_cache::find/hit/{}", nr_entries), 0, [&]() {
+                auto* res = cache.find(lookups[next]);
+                keep(res);
+                next = (next + 1) % lookups.size();
+            });
+            run(filter, std::format("lru_cache::find/miss/{}", nr_entries), 0, [&]() {
+                auto* res = cache.find("0:NOT-1");
+                keep(res);
+            });
+        }
+    }
+
+    // server reader thread -> decode workers -> UI thread, for replies needing no decoding
+    // and for properties replies
+    void bench_pipeline(std::string_view filter) {
+        constexpr size_t nr_replies = 256;
+        for (const bool with_decoding : {false, true}) {
+            reply_channel<decoded_reply> output;
+            decode_pipeline pipeline(output, 4);
+            const auto properties = make_properties_reply(100);
+
+            std::uint64_t request_number = 0;
+            const auto name = std::format("decode_pipeline/{}/{}", with_decoding ? "properties_100" : "raw", nr_replies);
+            run(filter, name, 0, [&]() {
+                std::vector<std::uint64_t> requests;
+                for (size_t i = 0; i < nr_replies; ++i) {
+                    ++request_number;
+                    if (with_decoding) {
+                        pipeline.expect(request_number, make_result_decoder<protocol::fetch_ticket_key_value_fields>(
+                            [](std::expected<protocol::ticket_properties, std::string> decoded) {
+                                return decoded.has_value() ? decoded->properties.size() : size_t{0};
+                            }));
+                    }
+                    auto msg = properties;
+                    msg.request_id = std::format("PRJ-1-fetch-key-value-list-{}", request_number);
+                    pipeline.push(std::move(msg));
+                    requests.push_back(request_number);
+                }
+                size_t nr_received = 0;
+                while (nr_received < nr_replies) {
+                    pollfd fd{ .fd = output.get_wake_up_fd(), .events = POLLIN, .revents = 0 };
+                    ::poll(&fd, 1, -1);
+                    nr_received += output.take_all().size();
+                }
+                for (const auto number : requests) {
+                    pipeline.forget(number);
+                }
+            });
+        }
+    }
+
+    // Feeds the same input to every base64 decoder the cpu supports, and compares their results
+    // with the scalar one's: number of characters decoded, bytes decoded, and nothing written
+    // past the output. Inputs are random valid ones, then the same with an invalid character or
+    // padding at each position. Sizes go past a few 24 and 48 characters blocks of the
+    // vectorised loops, so that invalid characters also land across their boundaries and in the
+    // tails the scalar decoder finishes.
+    auto check_base64_decoders(std::mt19937_64& rng) -> bool {
+        constexpr std::string_view alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        // padding, and the neighbours of each range of valid characters
+        constexpr std::array invalid_chars = {'=', '\0', '\n', ' ', '*', ',', '-', '.', ':', '@', '[', '`', '{',
+                                              static_cast<char>(0x80), static_cast<char>(0xFF)};
+        static constexpr std::uint8_t guard = 0xA5;
+        constexpr size_t guard_size = 64;
+        constexpr size_t max_nr_reported = 10;
+
+        const auto decoders = base64_quad_decoders();
+        size_t nr_checks = 0;
+        size_t nr_failures = 0;
+        const auto check = [&](std::string_view input) {
+            const auto nr_bytes = input.size() / 4 * 3;
+            std::vector<std::uint8_t> expected(nr_bytes + guard_size, guard);
+            const auto expected_nr_chars = decoders.front().decode(input.data(), input.size(), expected.data());
+            for (const auto& decoder : decoders | std::views::drop(1)) {
+                std::vector<std::uint8_t> output(nr_bytes + guard_size, guard);
+                const auto nr_chars = decoder.decode(input.data(), input.size(), output.data());
+                const auto nr_decoded = static_cast<std::ptrdiff_t>(nr_chars / 4 * 3);
+                ++nr_checks;
+                std::string_view error;
+                if (nr_chars != expected_nr_chars) {
+                    error = "stopped at another position";
+                } else if (!std::equal(output.begin(), output.begin() + nr_decoded, expected.begin())) {
+                    error = "decoded other bytes";
+                } else if (std::any_of(output.begin() + static_cast<std::ptrdiff_t>(nr_bytes), output.end(), [](std::uint8_t b) noexcept { return b != guard; })) {
+                    error = "wrote past the output";
+                } else {
+                    continue;
+                }
+                if (++nr_failures <= max_nr_reported) {
+                    std::cout << std::format("{} {} on {} chars: decoded {} chars where scalar decoded {}\n",
+                                             decoder.name, error, input.size(), nr_chars, expected_nr_chars);
+                }
+            }
+        };
+
+        std::vector<size_t> sizes;
+        for (size_t nr_chars = 0; nr_chars <= 400; nr_chars += 4) {
+            sizes.push_back(nr_chars);
+        }
+        sizes.push_back(4096);
+        for (const auto nr_chars : sizes) {
+            std::string input(nr_chars, '\0');
+            std::ranges::generate(input, [&]() { return alphabet[rng() % alphabet.size()]; });
+            check(input);
+            for (size_t pos = 0; pos < nr_chars; ++pos) {
+                const auto valid_char = input[pos];
+                for (const auto invalid_char : invalid_chars) {
+                    input[pos] = invalid_char;
+                    check(input);
+                }
+                input[pos] = valid_char;
+            }
+        }
+
+        std::string names;
+        for (const auto& decoder : decoders) {
+            names += names.empty() ? "" : ", ";
+            names += decoder.name;
+        }
+        std::cout << std::format("base64 decoders ({}): {} checks, {} failures\n", names, nr_checks, nr_failures);
+        return nr_failures == 0;
+    }
+} // namespace
+
+int main(int argc, char* argv[]) {
+    const std::string_view filter = (argc >= 2) ? argv[1] : "";
+    std::mt19937_64 rng(42);
+
+    if (filter == "--check") {
+        return check_base64_decoders(rng) ? 0 : 1;
+    }
+
+    bench_base64(filter, rng);
+    bench_issue_sort(filter, rng);
+    bench_properties_decode(filter);
+    bench_router_dispatch(filter);
+    bench_view_cache(filter, rng);
+    bench_pipeline(filter);
+    return 0;
+}
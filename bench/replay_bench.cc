@@ -0,0 +1,203 @@
+// Replays a session recorded by jira_gui (see session_trace.hh) through the same code as the
+// application: reader thread, reply framing, decode workers and dispatch on the main thread.
+// fake_jira_server sends the recorded replies, so the traffic is exactly the recorded one:
+//      JIRA_GUI_RECORD_SESSION=session.trace jira_gui
+//      jira_gui_replay [--original-pacing] <fake_jira_server> <trace>
+//
+// Replies are sent as fast as possible, or with the delays they were received with when
+// --original-pacing is given. Reports the throughput, and how long the main thread spent
+// dispatching each batch of replies, the stalls a window would see.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <format>
+#include <iostream>
+#include <numeric>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+
+#include "decode_pipeline.hh"
+#include "issue_keys.hh"
+#include "prog_handler.hh"
+#include "protocol.hh"
+#include "reply_channel.hh"
+#include "request_router.hh"
+#include "session_trace.hh"
+
+namespace {
+    using bench_clock = std::chrono::steady_clock;
+
+    // replies stop coming when the server dies
+    constexpr auto max_silence = std::chrono::seconds{10};
+
+    // the work the application does on the decode workers, without the Qt types
+    auto decoded_size(const protocol::binary_payload& payload) -> size_t {
+        std::vector<std::uint8_t> decoded(payload.size());
+        return payload.decode_into(decoded).has_value() ? decoded.size() : 0;
+    }
+
+    auto make_decoder(std::string_view verb) -> std::optional<reply_decoder> {
+        if (verb == protocol::fetch_ticket_list::verb) {
+            return make_result_decoder<protocol::fetch_ticket_list>([](std::expected<protocol::ticket_list, std::string> decoded) {
+                if (!decoded.has_value()) {
+                    return std::vector<std::uint32_t>{};
+                }
+                const std::vector<std::string_view> keys(decoded->keys.begin(), decoded->keys.end());
+                return sorted_issue_order(keys);
+            });
+        }
+        if (verb == protocol::fetch_ticket::verb) {
+            return make_result_decoder<protocol::fetch_ticket>([](std::expected<protocol::ticket_page, std::string> decoded) {
+                return decoded.has_value() ? decoded_size(decoded->html) : size_t{0};
+            });
+        }
+        if (verb == protocol::fetch_ticket_key_value_fields::verb) {
+            return make_result_decoder<protocol::fetch_ticket_key_value_fields>([](std::expected<protocol::ticket_properties, std::string> decoded) {
+                return decoded.has_value() ? decoded->properties.size() : size_t{0};
+            });
+        }
+        if (verb == protocol::fetch_attachment_list_for_ticket::verb) {
+            return make_result_decoder<protocol::fetch_attachment_list_for_ticket>([](std::expected<protocol::attachment_list, std::string> decoded) {
+                return decoded.has_value() ? decoded->attachments.size() : size_t{0};
+            });
+        }
+        if (verb == protocol::fetch_attachment_content::verb) {
+            return make_result_decoder<protocol::fetch_attachment_content>([](std::expected<protocol::attachment_content, std::string> decoded) {
+                return decoded.has_value() ? decoded_size(decoded->data) : size_t{0};
+            });
+        }
+        return std::nullopt;
+    }
+
+    // "<id> <verb> [arguments]\n"
+    auto request_verb(std::string_view request) -> std::string_view {
+        const auto id_end = request.find(' ');
+        if (id_end == std::string_view::npos) {
+            return {};
+        }
+        const auto rest = request.substr(id_end + 1);
+        return rest.substr(0, rest.find_first_of(" \n"));
+    }
+
+    auto to_ms(bench_clock::duration duration) -> double {
+        return std::chrono::duration<double, std::milli>(duration).count();
+    }
+} // namespace
+
+int main(int argc, char* argv[]) {
+    const auto original_pacing = (argc == 4) && (std::string_view(argv[1]) == "--original-pacing");
+    if ((argc != 3) && !original_pacing) {
+        std::cout << "usage: jira_gui_replay [--original-pacing] <fake_jira_server> <trace>\n";
+        return 1;
+    }
+    const char* const server_path = argv[argc - 2];
+    const std::string trace_path = argv[argc - 1];
+
+    const auto trace = read_session_trace(trace_path);
+    if (!trace.has_value()) {
+        std::cout << std::format("Error: {}\n", trace.error());
+        return 2;
+    }
+    if (trace->replies.empty()) {
+        std::cout << "Error: the trace has no reply\n";
+        return 2;
+    }
+    const auto recorded_format = (trace->replies.front().msg.encoding == payload_encoding::raw_bytes)
+        ? wire_format::binary_frames : wire_format::text_lines;
+
+    if (!set_sigpipe_signal_handler()) {
+        return 4;
+    }
+    const auto replay_arg = std::format("--replay={}", trace_path);
+    std::vector<const char*> server_args{replay_arg.c_str()};
+    if (original_pacing) {
+        server_args.push_back("--original-pacing");
+    }
+    auto server = ProgHandler::try_new(server_path, server_args);
+    if (!server.has_value()) {
+        std::cout << std::format("Error: failed to start the server: {}\n", server.error());
+        return 5;
+    }
+
+    reply_channel<decoded_reply> replies;
+    decode_pipeline decoders(replies, std::clamp(std::thread::hardware_concurrency(), 1u, 4u));
+    request_router router;
+
+    // the recorded requests aren't sent, but their replies are decoded and dispatched
+    // the way the application did when recording
+    size_t nr_handled = 0;
+    for (const auto& recorded : trace->requests) {
+        const auto request_number = parse_request_number(protocol::get_request_id(recorded.request));
+        if (!request_number.has_value()) {
+            continue;
+        }
+        if (auto decoder = make_decoder(request_verb(recorded.request)); decoder.has_value()) {
+            decoders.expect(request_number.value(), std::move(decoder.value()));
+        }
+        router.add(request_number.value(), [&](decoded_reply&) noexcept { ++nr_handled; }, [](const std::string&) noexcept {});
+    }
+
+    auto reader = server->start_background_message_listener(
+        [&](server_message msg) { decoders.push(std::move(msg)); },
+        [](std::string error) { std::cout << std::format("Error: {}", error); },
+        ProgHandler::listener_options{ .preferred_format = recorded_format, .use_bulk_channel = false });
+    auto writer = server->start_background_request_writer([](std::string request_id, std::string reason) {
+        std::cout << std::format("Error: failed to send {}: {}\n", request_id, reason);
+    });
+    if (!reader.has_value() || !writer.has_value()) {
+        std::cout << "Error: failed to start the threads talking to the server\n";
+        return 5;
+    }
+
+    const auto start = bench_clock::now();
+    size_t nr_received = 0;
+    size_t nr_payload_bytes = 0;
+    std::vector<bench_clock::duration> batch_durations;
+    while (nr_received < trace->replies.size()) {
+        pollfd fd{ .fd = replies.get_wake_up_fd(), .events = POLLIN, .revents = 0 };
+        if (::poll(&fd, 1, static_cast<int>(std::chrono::milliseconds{max_silence}.count())) <= 0) {
+            std::cout << std::format("Error: got {} of the {} recorded replies\n", nr_received, trace->replies.size());
+            break;
+        }
+        auto batch = replies.take_all();
+        if (batch.empty()) {
+            continue;
+        }
+        const auto batch_start = bench_clock::now();
+        for (auto& reply : batch) {
+            nr_payload_bytes += reply.msg.payload.size();
+            router.dispatch(reply);
+        }
+        batch_durations.push_back(bench_clock::now() - batch_start);
+        nr_received += batch.size();
+    }
+    const auto elapsed = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+    const auto recorded_duration = trace->replies.back().time - trace->replies.front().time;
+    const auto dispatch_total = std::accumulate(batch_durations.begin(), batch_durations.end(), bench_clock::duration{});
+    std::ranges::sort(batch_durations);
+    const auto longest_batch = batch_durations.empty() ? bench_clock::duration{} : batch_durations.back();
+    const auto median_batch = batch_durations.empty() ? bench_clock::duration{} : batch_durations[batch_durations.size() / 2];
+    std::cout << std::format("replayed {} replies ({} handled) in {:.1f} ms, recorded over {:.1f} ms: {:.0f} replies/s, {:.1f} MiB/s\n",
+                             nr_received, nr_handled, elapsed * 1000.0, to_ms(recorded_duration),
+                             static_cast<double>(nr_received) / elapsed,
+                             static_cast<double>(nr_payload_bytes) / (1024.0 * 1024.0) / elapsed);
+    std::cout << std::format("main thread: {} batches, {:.3f} ms dispatching, median batch {:.3f} ms, longest batch {:.3f} ms\n",
+                             batch_durations.size(), to_ms(dispatch_total), to_ms(median_batch), to_ms(longest_batch));
+
+    // same shutdown sequence as jira_gui
+    writer->request_stop();
+    writer->join();
+    reader->request_stop();
+    server->send_to_child(protocol::make_request({"exit-immediately"}, protocol::exit_server_now{}));
+    server->kill_child_after_timeout(std::chrono::milliseconds{500});
+    reader->join();
+    return 0;
+}
@@ -0,0 +1,101 @@
+#include <algorithm>
+#include <cstring>
+#include <format>
+#include <new>
+
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "bulk_channel.hh"
+
+auto bulk_channel::try_new(size_t ring_capacity) -> std::expected<std::shared_ptr<bulk_channel>, std::string> {
+    // the data area is mapped right after the control block
+    const auto page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    if ((ring_capacity == 0) || (ring_capacity % page_size != 0) || (data_offset % page_size != 0)) {
+        return std::unexpected(std::format("the capacity of the bulk channel must be a multiple of the page size ({} bytes)", page_size));
+    }
+
+    const auto memfd = memfd_create("jira_gui_bulk_channel", MFD_CLOEXEC);
+    if (memfd == -1) {
+        return std::unexpected(std::format("memfd_create failed. Err is {}: {}", errno, strerror(errno)));
+    }
+
+    const auto total_size = data_offset + ring_capacity;
+    // the file is sparse, pages are only allocated the first time the server writes to them
+    if (ftruncate(memfd, static_cast<off_t>(total_size)) == -1) {
+        auto err = std::format("failed to resize the bulk channel. Err is {}: {}", errno, strerror(errno));
+        close(memfd);
+        return std::unexpected(std::move(err));
+    }
+
+    auto* const mapping = mmap(nullptr, total_size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (mapping == MAP_FAILED) {
+        auto err = std::format("failed to map the bulk channel. Err is {}: {}", errno, strerror(errno));
+        close(memfd);
+        return std::unexpected(std::move(err));
+    }
+
+    auto* const control = new (mapping) control_block{.capacity = ring_capacity, .released_position = 0};
+
+    // constructor is private, hence no make_shared
+    return std::shared_ptr<bulk_channel>(new bulk_channel(memfd, ring_capacity, static_cast<std::uint8_t*>(mapping), control));
+}
+
+bulk_channel::bulk_channel(int memfd, size_t ring_capacity, std::uint8_t* ring_mapping, control_block* ring_control) noexcept
+    : fd(memfd)
+    , capacity(ring_capacity)
+    , mapping(ring_mapping)
+    , control(ring_control)
+{
+}
+
+bulk_channel::~bulk_channel() noexcept {
+    munmap(mapping, data_offset + capacity);
+    close(fd);
+}
+
+auto bulk_channel::take(const bulk_descriptor& descriptor) -> std::expected<byte_slice, std::string> {
+    const auto [position, size] = descriptor;
+    const auto offset = position % capacity;
+
+    const auto released_position = control->released_position.load(std::memory_order_acquire);
+    {
+        const std::lock_guard lock(mutex);
+        // a server writing outside the space it was given would overwrite payloads still in use
+        if ((position < next_position) || (size > capacity) || (offset + size > capacity)
+            || (position + size > released_position + capacity)) {
+            return std::unexpected(std::format("invalid bulk payload of {} bytes at position {}", size, position));
+        }
+        next_position = position + size;
+        regions_in_use.push_back(region{.begin = position, .end = position + size, .is_released = false});
+    }
+
+    struct lease {
+        std::shared_ptr<bulk_channel> channel;
+        std::uint64_t position;
+        ~lease() { channel->release(position); }
+    };
+    auto owner = std::make_shared<const lease>(shared_from_this(), position);
+    return byte_slice(std::move(owner), mapping + data_offset + offset, size);
+}
+
+void bulk_channel::release(std::uint64_t position) noexcept {
+    const std::lock_guard lock(mutex);
+    const auto it = std::find_if(regions_in_use.begin(), regions_in_use.end(), [=](const region& r) {
+        return r.begin == position;
+    });
+    if (it == regions_in_use.end()) {
+        return;
+    }
+    it->is_released = true;
+
+    // The pages stay allocated, the next payloads written there don't fault them in again.
+    // Punching them out cost more than the copy through the pipe the ring saves.
+    auto new_released_position = control->released_position.load(std::memory_order_relaxed);
+    while ((!regions_in_use.empty()) && (regions_in_use.front().is_released)) {
+        // also covers the unused end of the ring the server skipped before this payload
+        new_released_position = regions_in_use.front().end;
+        regions_in_use.pop_front();
+    }
+    control->released_position.store(new_released_position, std::memory_order_release);
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <expected>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+#include "receive_buffer.hh"
+#include "reply_framing.hh"
+
+// Shared memory ring carrying big payloads (attachments, ticket pages) from the server, so
+// that they don't have to be copied through the pipe and don't delay the small replies
+// queued behind them.
+//
+// The ring is a memfd the server inherits as fd server_fd. It starts with a control block,
+// followed by the data area at offset data_offset:
+//      offset 0: u64         capacity of the data area, written once by the client
+//      offset 8: atomic u64  released position, written by the client
+//
+// Positions grow forever, the data of position p being at offset p % capacity of the data
+// area. The server writes a payload at the first position after the previous payload, or
+// at the next multiple of capacity if the payload wouldn't fit before the end of the data
+// area, as payloads never wrap around. It can only use positions below released position +
+// capacity; when a payload doesn't fit, it sends it through the pipe as usual. Once it wrote
+// a payload, it sends a bulk frame describing it (see reply_framing.hh).
+//
+// On the client side, payloads are handed out as byte_slices pointing straight into the
+// mapping. The released position only moves forward when every slice of the payloads before
+// it is gone, so slices can be kept for as long as needed.
+class bulk_channel final : public std::enable_shared_from_this<bulk_channel> {
+public:
+    // the server is told about the channel with "ENABLE_BULK_CHANNEL <server_fd>"
+    static constexpr int server_fd = 3;
+    static constexpr std::string_view server_fd_as_string = "3";
+    static constexpr size_t data_offset = size_t{64} * 1024; // multiple of the page size on all platforms
+    // Pages are allocated as the server first writes to them, and kept to be reused by the
+    // next payloads, so the ring costs up to its capacity in memory. Bigger payloads go through
+    // the pipe.
+    static constexpr size_t default_capacity = size_t{64} * 1024 * 1024;
+
+    static auto try_new(size_t capacity = default_capacity) -> std::expected<std::shared_ptr<bulk_channel>, std::string>;
+
+    bulk_channel(const bulk_channel&) = delete;
+    bulk_channel& operator=(const bulk_channel&) = delete;
+    ~bulk_channel() noexcept;
+
+    auto get_fd() const noexcept -> int { return fd; }
+    auto get_capacity() const noexcept -> size_t { return capacity; }
+
+    // Returns the payload described by a bulk frame. Descriptors must be given in the order
+    // the server sent them.
+    auto take(const bulk_descriptor& descriptor) -> std::expected<byte_slice, std::string>;
+
+    // layout of the start of the file, for servers mapping it
+    struct control_block {
+        std::uint64_t capacity;
+        std::atomic<std::uint64_t> released_position;
+    };
+    static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "the control block is shared with another process");
+
+private:
+    struct region {
+        std::uint64_t begin;
+        std::uint64_t end;
+        bool is_released;
+    };
+
+    bulk_channel(int memfd, size_t ring_capacity, std::uint8_t* ring_mapping, control_block* ring_control) noexcept;
+
+    // called when the last slice on the payload starting at position is gone. Can be called from any thread.
+    void release(std::uint64_t position) noexcept;
+
+    int fd;
+    size_t capacity;
+    std::uint8_t* mapping; // control block, then data area
+    control_block* control; // start of mapping
+    std::mutex mutex = {};
+    std::deque<region> regions_in_use = {}; // in the order the server wrote them
+    std::uint64_t next_position = 0; // payloads can't start before this position
+};
@@ -0,0 +1,103 @@
+#include <algorithm>
+
+#include "decode_pipeline.hh"
+#include "request_router.hh"
+
+namespace {
+    constexpr size_t arena_overhead = 4096;
+    // bigger replies make the arena grow geometrically
+    constexpr size_t max_initial_arena_size = size_t{1024} * 1024;
+    // Replies this small are decoded in a block each worker reuses from one reply to the next.
+    // Getting a fresh block from the heap took longer than decoding a 10 fields properties reply.
+    constexpr size_t worker_arena_size = size_t{64} * 1024;
+}
+
+decode_pipeline::decode_pipeline(reply_channel<decoded_reply>& output_channel, size_t nr_workers)
+    : output(output_channel)
+{
+    nr_workers = std::max(nr_workers, size_t{1});
+    queues.reserve(nr_workers);
+    workers.reserve(nr_workers);
+    for (size_t i = 0; i < nr_workers; ++i) {
+        queues.emplace_back(std::make_unique<worker_queue>());
+    }
+    for (auto& queue : queues) {
+        workers.emplace_back([this, &queue = *queue](std::stop_token stop_token) {
+            decode_messages(stop_token, queue);
+        });
+    }
+}
+
+void decode_pipeline::expect(std::uint64_t request_number, reply_decoder decoder) {
+    const std::lock_guard lock(decoders_mutex);
+    decoders.insert_or_assign(request_number, std::make_shared<const reply_decoder>(std::move(decoder)));
+}
+
+void decode_pipeline::forget(std::uint64_t request_number) {
+    const std::lock_guard lock(decoders_mutex);
+    decoders.erase(request_number);
+}
+
+void decode_pipeline::push(server_message msg) {
+    // replies without a request number are never decoded, any worker does
+    const auto request_number = parse_request_number(msg.request_id).value_or(0);
+    auto& queue = *queues[request_number % queues.size()];
+    {
+        const std::lock_guard lock(queue.mutex);
+        queue.queued.emplace_back(std::move(msg));
+    }
+    queue.new_message.notify_one();
+}
+
+auto decode_pipeline::take_decoder(const server_message& msg) -> std::shared_ptr<const reply_decoder> {
+    const auto request_number = parse_request_number(msg.request_id);
+    if (!request_number.has_value()) {
+        return nullptr;
+    }
+    const std::lock_guard lock(decoders_mutex);
+    const auto it = decoders.find(request_number.value());
+    if (it == decoders.end()) {
+        return nullptr;
+    }
+    auto res = it->second;
+    if (msg.kind == reply_kind::finished) {
+        decoders.erase(it);
+    }
+    return res;
+}
+
+void decode_pipeline::decode_messages(std::stop_token stop_token, worker_queue& queue) {
+    std::deque<server_message> to_decode;
+    std::vector<std::byte> worker_arena_block(worker_arena_size);
+    reply_arena worker_arena(worker_arena_block);
+    while (true) {
+        {
+            std::unique_lock lock(queue.mutex);
+            if (!queue.new_message.wait(lock, stop_token, [&queue]() { return !queue.queued.empty(); })) {
+                return; // stop requested
+            }
+            std::swap(to_decode, queue.queued);
+        }
+
+        for (auto& msg : to_decode) {
+            const auto decoder = take_decoder(msg);
+            auto reply = decoded_reply{ .msg = std::move(msg) };
+            if ((decoder != nullptr) && (reply.msg.kind == reply_kind::result)) {
+                // decoded data is at most as big as the payload, plus the containers around it
+                const auto arena_size = std::min(reply.msg.payload.size(), max_initial_arena_size) + arena_overhead;
+                if (arena_size <= worker_arena_size) {
+                    worker_arena.reset();
+                    reply.result = (*decoder)(reply.msg, &worker_arena);
+                    reply.decoding_allocations = worker_arena.stats();
+                } else {
+                    // The first block is only allocated if the decoder uses the arena.
+                    reply_arena arena(arena_size);
+                    reply.result = (*decoder)(reply.msg, &arena);
+                    reply.decoding_allocations = arena.stats();
+                }
+            }
+            output.push(std::move(reply));
+        }
+        to_decode.clear();
+    }
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <any>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory_resource>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "protocol.hh"
+#include "reply_arena.hh"
+#include "reply_channel.hh"
+#include "reply_framing.hh"
+
+// Reply as delivered to the UI thread. For RESULT replies to a request registered with a
+// decoder, result holds what the decoder returned. It is empty otherwise.
+struct decoded_reply {
+    server_message msg;
+    std::any result = {};
+    arena_stats decoding_allocations = {}; // what decoding the reply allocated, for profiling
+};
+
+// Runs on a worker thread. Returns the fully prepared result (decoded, sorted, converted to
+// whatever the UI needs), so that the UI thread only has to populate widgets.
+// Temporary data should be allocated from memory, the arena of the reply. The arena is
+// released as soon as the decoder returns, so the result must not use it.
+using reply_decoder = std::function<std::any(const server_message& msg, std::pmr::memory_resource* memory)>;
+
+// Decoder for RESULT replies to a request of type Cmd: the reply is decoded with the protocol
+// schema, then finish turns the std::expected it got into the result given to the UI thread.
+template <protocol::command Cmd, typename Finish>
+auto make_result_decoder(Finish finish) -> reply_decoder {
+    return [finish = std::move(finish)](const server_message& msg, std::pmr::memory_resource* memory) -> std::any {
+        return finish(protocol::decode_result<Cmd>(msg, memory));
+    };
+}
+
+// result of the decoder, or nullptr if the reply wasn't decoded into a T
+template <typename T>
+auto get_result(decoded_reply& reply) noexcept -> T* {
+    return std::any_cast<T>(&reply.result);
+}
+
+// Stage between the thread reading replies from the server and the UI thread. Replies are
+// decoded by a small pool of worker threads, then pushed to the output channel.
+// Replies to the same request are always handled by the same worker, so they reach the
+// output in the order the server sent them. Replies to different requests may be reordered.
+class decode_pipeline final {
+public:
+    decode_pipeline(reply_channel<decoded_reply>& output, size_t nr_workers);
+    decode_pipeline(const decode_pipeline&) = delete;
+    decode_pipeline& operator=(const decode_pipeline&) = delete;
+    // stops the workers. Replies not decoded yet are dropped
+    ~decode_pipeline() = default;
+
+    // Must be called before the request is sent, so that its replies can't come back before
+    // the decoder is known. The decoder is dropped after the FINISHED reply.
+    void expect(std::uint64_t request_number, reply_decoder decoder);
+    // replies to this request aren't decoded anymore
+    void forget(std::uint64_t request_number);
+
+    // called by the thread reading replies from the server
+    void push(server_message msg);
+
+private:
+    struct worker_queue {
+        std::mutex mutex = {};
+        std::condition_variable_any new_message = {};
+        std::deque<server_message> queued = {};
+    };
+
+    void decode_messages(std::stop_token stop_token, worker_queue& queue);
+    auto take_decoder(const server_message& msg) -> std::shared_ptr<const reply_decoder>;
+
+    reply_channel<decoded_reply>& output;
+
+    std::mutex decoders_mutex = {};
+    std::unordered_map<std::uint64_t, std::shared_ptr<const reply_decoder>> decoders = {};
+
+    // queues are declared before the workers, so they outlive them
+    std::vector<std::unique_ptr<worker_queue>> queues = {};
+    std::vector<std::jthread> workers = {};
+};
@@ -0,0 +1,184 @@
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <charconv>
+#include <limits>
+#include <numeric>
+#include <optional>
+#include <ranges>
+#include <unordered_map>
+
+#include "issue_keys.hh"
+
+namespace {
+    // Parses text the way std::stol does, without allocating or throwing: leading white
+    // spaces, an optional sign, then digits up to the first non-digit character.
+    auto parse_long(std::string_view text) -> std::optional<long> {
+        constexpr std::string_view white_spaces = " \t\n\v\f\r";
+        const auto start = text.find_first_not_of(white_spaces);
+        if (start == std::string_view::npos) {
+            return std::nullopt;
+        }
+        text.remove_prefix(start);
+        if (text.starts_with('+')) {
+            text.remove_prefix(1);
+            // from_chars would accept a minus sign here, stol doesn't
+            if (text.starts_with('-')) {
+                return std::nullopt;
+            }
+        }
+        long res = 0;
+        const auto [ptr, error] = std::from_chars(text.data(), text.data() + text.size(), res);
+        if (error != std::errc{}) {
+            return std::nullopt;
+        }
+        return res;
+    }
+
+    // the project part of a key, dash included. Comparing those is comparing the keys
+    // of different projects lexicographically, since the dash ends the first one to differ.
+    auto get_project(std::string_view key) -> std::optional<std::string_view> {
+        const auto dash = key.find('-');
+        if (dash == std::string_view::npos) {
+            return std::nullopt;
+        }
+        return key.substr(0, dash + 1);
+    }
+
+    // Stable LSD radix sort of the values, one byte at a time, skipping the high bytes all
+    // values have as zero. Sorts indexes along.
+    void radix_sort(std::vector<std::uint64_t>& values, std::vector<std::uint32_t>& indexes) {
+        const auto max_value = std::ranges::max(values);
+        const auto nr_passes = static_cast<unsigned>(std::bit_width(max_value) + 7) / 8;
+
+        std::vector<std::uint64_t> values_tmp(values.size());
+        std::vector<std::uint32_t> indexes_tmp(indexes.size());
+        for (unsigned pass = 0; pass < nr_passes; ++pass) {
+            const auto shift = pass * 8;
+            std::array<size_t, 257> offsets = {};
+            for (const auto value : values) {
+                ++offsets[((value >> shift) & 0xFF) + 1];
+            }
+            std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+            for (size_t i = 0; i < values.size(); ++i) {
+                const auto dest = offsets[(values[i] >> shift) & 0xFF]++;
+                values_tmp[dest] = values[i];
+                indexes_tmp[dest] = indexes[i];
+            }
+            values.swap(values_tmp);
+            indexes.swap(indexes_tmp);
+        }
+    }
+
+    // equivalent keys are ordered by index, to keep their relative order like radix_sort does
+    void sort_keys(std::vector<std::uint32_t>& order, const std::vector<issue_key>& parsed) {
+        std::ranges::sort(order, [&](std::uint32_t a, std::uint32_t b) noexcept {
+            if (is_issue_before(parsed[a], parsed[b])) {
+                return true;
+            }
+            return !is_issue_before(parsed[b], parsed[a]) && (a < b);
+        });
+    }
+} // namespace
+
+bool is_issue_before(std::string_view a, std::string_view b) {
+    const auto a_project = get_project(a);
+    const auto b_project = get_project(b);
+    if (!a_project.has_value() || !b_project.has_value() || (*a_project != *b_project)) {
+        return a < b;
+    }
+    const auto a_number = parse_long(a.substr(a_project->size()));
+    const auto b_number = parse_long(b.substr(b_project->size()));
+    if (!a_number.has_value() || !b_number.has_value()) {
+        return a < b;
+    }
+    return *a_number < *b_number;
+}
+
+auto parse_issue_keys(std::span<const std::string_view> keys) -> std::vector<issue_key> {
+    std::vector<issue_key> res;
+    res.reserve(keys.size());
+
+    // ids are first given in order of appearance, then renumbered once all projects are known
+    std::unordered_map<std::string_view, std::uint32_t> project_ids;
+    for (const auto key : keys) {
+        auto& parsed = res.emplace_back(issue_key{ .text = key });
+        const auto project = get_project(key);
+        if (!project.has_value()) {
+            continue;
+        }
+        const auto number = parse_long(key.substr(project->size()));
+        if (!number.has_value()) {
+            continue;
+        }
+        parsed.number = *number;
+        parsed.has_number = true;
+        parsed.project = project_ids.try_emplace(*project, static_cast<std::uint32_t>(project_ids.size())).first->second;
+    }
+
+    std::vector<std::string_view> projects(project_ids.size());
+    for (const auto& [project, id] : project_ids) {
+        projects[id] = project;
+    }
+    std::vector<std::uint32_t> by_name(projects.size());
+    std::iota(by_name.begin(), by_name.end(), 0U);
+    std::ranges::sort(by_name, {}, [&](std::uint32_t id) noexcept { return projects[id]; });
+    std::vector<std::uint32_t> renumbered(projects.size());
+    for (std::uint32_t rank = 0; rank < by_name.size(); ++rank) {
+        renumbered[by_name[rank]] = rank;
+    }
+    for (auto& parsed : res) {
+        if (parsed.has_number) {
+            parsed.project = renumbered[parsed.project];
+        }
+    }
+    return res;
+}
+
+bool is_issue_before(const issue_key& a, const issue_key& b) noexcept {
+    if (!a.has_number || !b.has_number) {
+        return a.text < b.text;
+    }
+    if (a.project != b.project) {
+        return a.project < b.project;
+    }
+    return a.number < b.number;
+}
+
+auto sorted_issue_order(std::span<const std::string_view> keys) -> std::vector<std::uint32_t> {
+    std::vector<std::uint32_t> order(keys.size());
+    std::iota(order.begin(), order.end(), 0U);
+    if (keys.empty()) {
+        return order;
+    }
+
+    const auto parsed = parse_issue_keys(keys);
+    const auto all_have_number = std::ranges::all_of(parsed, &issue_key::has_number);
+    if (!all_have_number) {
+        // odd keys are compared as text with everything, so there is no integer to sort on
+        sort_keys(order, parsed);
+        return order;
+    }
+
+    // The usual case: pack project and number in a single integer and radix sort those.
+    const auto [min_number, max_number] = std::ranges::minmax(parsed | std::views::transform(&issue_key::number));
+    const auto number_range = static_cast<std::uint64_t>(max_number) - static_cast<std::uint64_t>(min_number);
+    const auto max_project = std::ranges::max(parsed | std::views::transform(&issue_key::project));
+    const auto number_bits = static_cast<unsigned>(std::bit_width(number_range));
+    const auto project_bits = static_cast<unsigned>(std::bit_width(std::uint64_t{max_project}));
+    if (number_bits + project_bits > std::numeric_limits<std::uint64_t>::digits) {
+        sort_keys(order, parsed);
+        return order;
+    }
+
+    std::vector<std::uint64_t> packed;
+    packed.reserve(parsed.size());
+    for (const auto& key : parsed) {
+        const auto number = static_cast<std::uint64_t>(key.number) - static_cast<std::uint64_t>(min_number);
+        // shifting by 64 is undefined, number_bits is 64 only when there is a single project
+        const auto project = (project_bits == 0) ? 0 : (std::uint64_t{key.project} << number_bits);
+        packed.push_back(project | number);
+    }
+    radix_sort(packed, order);
+    return order;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <vector>
+
+// Ticket keys are PROJECT-NUMBER. Keys of the same project are ordered by number, everything
+// else (different projects, keys without a dash or a number) lexicographically.
+bool is_issue_before(std::string_view a, std::string_view b);
+
+// Key parsed once, so comparing two of them doesn't have to look at the text again.
+struct issue_key {
+    std::string_view text;
+    // interned project name (text up to the first dash). Only meaningful when has_number.
+    std::uint32_t project = 0;
+    long number = 0;
+    // false when the key has no dash, or nothing after it parses as a number. Such keys
+    // are compared lexicographically with any other one.
+    bool has_number = false;
+};
+
+// Parses every key. Projects are interned by ascending name order (as is_issue_before sees
+// them), so comparing keys of different projects is comparing their project ids.
+auto parse_issue_keys(std::span<const std::string_view> keys) -> std::vector<issue_key>;
+
+// same result as is_issue_before on the keys' text
+bool is_issue_before(const issue_key& a, const issue_key& b) noexcept;
+
+// Returns the indexes of keys in is_issue_before order. Equivalent keys (e.g. ABC-01 and
+// ABC-1) keep their relative order.
+auto sorted_issue_order(std::span<const std::string_view> keys) -> std::vector<std::uint32_t>;
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+struct lru_cache_stats {
+    size_t nr_entries;
+    size_t nr_bytes;
+    std::uint64_t nr_hits;
+    std::uint64_t nr_misses;
+    std::uint64_t nr_evictions;
+};
+
+// Keeps the most recently used values as long as they fit in a byte budget. The size of a
+// value is given by the caller when inserting it, the cache doesn't look into values.
+// Not thread safe.
+template <typename Value>
+class lru_cache final {
+public:
+    explicit lru_cache(size_t max_nr_bytes) noexcept
+        : budget(max_nr_bytes)
+    {
+    }
+
+    lru_cache(const lru_cache&) = delete;
+    lru_cache& operator=(const lru_cache&) = delete;
+
+    // nullptr on a miss. The value stays valid until the next insert, erase or clear.
+    auto find(std::string_view key) -> Value* {
+        const auto it = index.find(key);
+        if (it == index.end()) {
+            ++nr_misses;
+            return nullptr;
+        }
+        ++nr_hits;
+        entries.splice(entries.begin(), entries, it->second);
+        return &it->second->value;
+    }
+
+    // Unlike find, doesn't count as a use of the value, nor as a hit or a miss
+    auto contains(std::string_view key) const -> bool {
+        return index.contains(key);
+    }
+
+    // Replaces the value cached for key, if any, then evicts the least recently used values
+    // until everything fits. A value bigger than the whole budget isn't cached.
+    void insert(std::string key, Value value, size_t nr_bytes) {
+        erase(key);
+        if (nr_bytes > budget) {
+            return;
+        }
+        entries.push_front(entry{ .key = std::move(key), .value = std::move(value), .nr_bytes = nr_bytes });
+        index.emplace(entries.front().key, entries.begin());
+        nr_bytes_held += nr_bytes;
+        while (nr_bytes_held > budget) {
+            const auto& oldest = entries.back();
+            nr_bytes_held -= oldest.nr_bytes;
+            index.erase(oldest.key);
+            entries.pop_back();
+            ++nr_evictions;
+        }
+    }
+
+    void erase(std::string_view key) {
+        const auto it = index.find(key);
+        if (it == index.end()) {
+            return;
+        }
+        const auto entry_it = it->second;
+        nr_bytes_held -= entry_it->nr_bytes;
+        index.erase(it);
+        entries.erase(entry_it);
+    }
+
+    void clear() {
+        index.clear();
+        entries.clear();
+        nr_bytes_held = 0;
+    }
+
+    auto stats() const noexcept -> lru_cache_stats {
+        return {
+            .nr_entries = entries.size(),
+            .nr_bytes = nr_bytes_held,
+            .nr_hits = nr_hits,
+            .nr_misses = nr_misses,
+            .nr_evictions = nr_evictions,
+        };
+    }
+
+private:
+    struct entry {
+        std::string key;
+        Value value;
+        size_t nr_bytes;
+    };
+
+    size_t budget;
+    size_t nr_bytes_held = 0;
+    // most recently used first. Nodes never move in memory, so the index points into them
+    std::list<entry> entries = {};
+    std::unordered_map<std::string_view, typename std::list<entry>::iterator> index = {};
+    std::uint64_t nr_hits = 0;
+    std::uint64_t nr_misses = 0;
+    std::uint64_t nr_evictions = 0;
+};
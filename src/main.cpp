@@ -1,20 +1,54 @@
 #include <QApplication>
+#include <QSocketNotifier>
+#include <algorithm>
+#include <charconv>
+#include <cstdlib>
+#include <expected>
+#include <memory>
 #include <optional>
+#include <span>
+#include <string_view>
 #include <iostream>
 #include <thread>
 
+#include "decode_pipeline.hh"
 #include "mainwindow.h"
 #include "prog_handler.hh"
+#include "protocol.hh"
+#include "reply_channel.hh"
+#include "render_cache.hh"
+#include "session_trace.hh"
+#include "string_table.hh"
 #include "temp_file_handler.hh"
 
+namespace {
+    // size in bytes of the budget given in MiB by the environment variable name, if set
+    auto mib_from_env(const char* name, size_t default_mib) -> std::expected<size_t, std::string> {
+        const char* const value = std::getenv(name);
+        if (value == nullptr) {
+            return default_mib * 1024 * 1024;
+        }
+        const auto text = std::string_view(value);
+        size_t mib = 0;
+        if (const auto [ptr, error] = std::from_chars(text.data(), text.data() + text.size(), mib);
+            (error != std::errc{}) || (ptr != text.data() + text.size())) {
+            return std::unexpected(std::format("invalid {} value: {}", name, text));
+        }
+        return mib * 1024 * 1024;
+    }
+}
+
 int main(int argc, char *argv[])
 {
     std::optional<const char*> exec_path;
+    // usage: jira_gui [server [server arguments...]], e.g. a fake server and its workload
+    std::span<const char* const> server_args;
     MyTempFile embedded_server_handler;
     bool using_embedded_server;
     if (argc >= 2) {
         using_embedded_server = false;
         exec_path = argv[1];
+        server_args = std::span<const char* const>(argv + 2, static_cast<size_t>(argc - 2));
     } else {
         if (!embedded_server_handler.initialise()) {
             std::cout << "Error: failed to create the temprorary file to hold the local server\n";
@@ -29,7 +63,7 @@ int main(int argc, char *argv[])
         return 4;
     };
 
-    auto prog_handler = ProgHandler::try_new(exec_path.value());
+    auto prog_handler = ProgHandler::try_new(exec_path.value(), server_args);
     if (using_embedded_server) {
         embedded_server_handler.delete_file();
     }
@@ -39,13 +73,67 @@ int main(int argc, char *argv[])
     }
     auto& prog_handler_v = prog_handler.value();
 
+    // the traffic with the server can be recorded, to be replayed later by jira_gui_replay
+    if (const char* const trace_path = std::getenv("JIRA_GUI_RECORD_SESSION"); trace_path != nullptr) {
+        auto recorder = session_recorder::try_new(trace_path);
+        if (!recorder.has_value()) {
+            std::cout << std::format("Error: failed to record the session: {}\n", recorder.error());
+            return 5;
+        }
+        prog_handler_v.record_session(std::move(recorder.value()));
+    }
+
+    // replies are delivered to the window in batches: the decode workers push them in the channel,
+    // and the notifier wakes the event loop up once for all the replies available at that point.
+    reply_channel<decoded_reply> server_replies;
+    if (!server_replies.is_valid()) {
+        std::cout << "Failed to create the channel to get messages from the server\n";
+        return 5;
+    }
+    // property names and common values, shared by all the tickets. Declared before the
+    // decode workers which intern strings in it.
+    string_table shared_strings;
+
+    // memory kept for the views of recently viewed tickets and for the prefetched ones, and
+    // disk space for what is shown at startup. 0 disables the last two.
+    const auto view_cache_budget = mib_from_env("JIRA_GUI_VIEW_CACHE_MIB", 64);
+    const auto prefetch_budget = mib_from_env("JIRA_GUI_PREFETCH_MIB", 16);
+    const auto render_cache_budget = mib_from_env("JIRA_GUI_RENDER_CACHE_MIB", 128);
+    for (const auto* budget : {&view_cache_budget, &prefetch_budget, &render_cache_budget}) {
+        if (!budget->has_value()) {
+            std::cout << std::format("Error: {}\n", budget->error());
+            return 5;
+        }
+    }
+    // what the previous run showed, painted before the server answers. Also declared before
+    // the decode workers which write to it. Working without it is fine.
+    std::unique_ptr<render_cache> previous_runs_cache;
+    if (render_cache_budget.value() != 0) {
+        const auto path = render_cache::default_path();
+        auto opened = path.has_value() ? render_cache::try_open(path.value(), render_cache_budget.value())
+                                       : std::unexpected(path.error());
+        if (opened.has_value()) {
+            previous_runs_cache = std::move(opened.value());
+        } else {
+            std::cout << std::format("Warning: running without the render cache: {}\n", opened.error());
+        }
+    }
+    // decoding, sorting and saving files happen on these workers, not on the UI thread
+    decode_pipeline reply_decoders(server_replies, std::clamp(std::thread::hardware_concurrency(), 1u, 4u));
+
     QApplication a(argc, argv);
-    MainWindow w (prog_handler_v);
+    MainWindow w (prog_handler_v, reply_decoders, shared_strings, view_cache_budget.value(), prefetch_budget.value(), previous_runs_cache.get());
 
     w.show();
+
+    QSocketNotifier server_replies_notifier(server_replies.get_wake_up_fd(), QSocketNotifier::Read);
+    QObject::connect(&server_replies_notifier, &QSocketNotifier::activated, &w, [&]() {
+        w.do_on_server_replies(server_replies.take_all());
+    });
+
     auto server_reader_thread = prog_handler_v.start_background_message_listener(
-        [&](std::string msg){
-            QMetaObject::invokeMethod(&w, &MainWindow::do_on_server_reply, std::move(msg));
+        [&](server_message msg){
+            reply_decoders.push(std::move(msg));
         },
         [&](std::string msg) {
             QMetaObject::invokeMethod(&w, &MainWindow::do_on_server_error, std::move(msg));
@@ -58,10 +146,41 @@ int main(int argc, char *argv[])
     }
     auto& msg_sender_v = server_reader_thread.value();
 
+    auto request_writer_thread = prog_handler_v.start_background_request_writer(
+        [&](std::string request_id, std::string reason) {
+            QMetaObject::invokeMethod(&w, &MainWindow::do_on_request_failed, std::move(request_id), std::move(reason));
+        }
+    );
+
+    if (!request_writer_thread) {
+        std::cout << "Failed to start a background thread to send requests to the server\n";
+        return 5;
+    }
+    auto& request_writer_v = request_writer_thread.value();
+
     const auto ret = a.exec();
 
+    const auto strings_stats = shared_strings.stats();
+    std::cout << std::format("Shared strings: {} held in {} bytes, {} bytes saved over {} lookups\n",
+                             strings_stats.nr_strings, strings_stats.nr_bytes_held,
+                             strings_stats.nr_bytes_saved, strings_stats.nr_lookups);
+    const auto cache_stats = w.view_cache_stats();
+    const auto nr_cache_lookups = cache_stats.nr_hits + cache_stats.nr_misses;
+    std::cout << std::format("Ticket view cache: {} hits, {} misses ({:.1f}% hit rate), {} evictions, {} views held in {} bytes\n",
+                             cache_stats.nr_hits, cache_stats.nr_misses,
+                             (nr_cache_lookups == 0) ? 0.0 : 100.0 * static_cast<double>(cache_stats.nr_hits) / static_cast<double>(nr_cache_lookups),
+                             cache_stats.nr_evictions, cache_stats.nr_entries, cache_stats.nr_bytes);
+    const auto prefetched = w.prefetcher_stats();
+    std::cout << std::format("Prefetch: {} views requested, {} served, {} evicted unused, {} views held in {} bytes\n",
+                             prefetched.nr_requested, prefetched.nr_served, prefetched.cache.nr_evictions,
+                             prefetched.cache.nr_entries, prefetched.cache.nr_bytes);
+
+    // the writer must be gone before writing directly to the server
+    request_writer_v.request_stop();
+    request_writer_v.join();
+
     msg_sender_v.request_stop();
-    prog_handler_v.send_to_child("exit-immediately EXIT_SERVER_NOW\n");
+    prog_handler_v.send_to_child(protocol::make_request({"exit-immediately"}, protocol::exit_server_now{}));
     prog_handler_v.kill_child_after_timeout(std::chrono::milliseconds{500});
     msg_sender_v.join();
 
@@ -78,10 +197,12 @@ int main(int argc, char *argv[])
     //
     // The window was declared after the prog handler, hence it is is the prog_handler
     // that outlives the window. In the prog handler, the references are used only
-    // when receiving a message from the server in the background thread, in order to
-    // call do_on_server_reply or do_on_server_error through the InvokeMethod.
-    // When reaching this point, the background thread already exited since we
-    // sent a stop request and then joined the thread. Hence from here on, that
+    // in the background threads, in order to call do_on_server_error or
+    // do_on_request_failed through the InvokeMethod. Replies themselves go through
+    // the decode workers and the server_replies channel and don't need a reference
+    // to the window.
+    // When reaching this point, the background threads already exited since we
+    // sent a stop request and then joined the threads. Hence from here on, that
     // reference won't be used anymore, and the window destructor hasn't been called
     // yet.
     //
@@ -100,12 +221,9 @@ int main(int argc, char *argv[])
     // be the program's return code.
     //
     // A better design would be to avoid having references becoming invalid in the
-    // first place. Here we have a circular dependency since the prog_handler and
-    // the window need to know about each other. To break this, a better design would
-    // be to let make communication through a message channel that outlives both of
-    // them. Some signaling through condition variables would be needed to avoid
-    // polling for messages. Bonus point, moving some work currently done in the UI
-    // thread, such as base64 decoding, sorting data, saving files, ... could then
-    // easily be moved out into a worker thread, thus improving user interactivity.
+    // first place. Replies already go through the decode workers and a message
+    // channel which outlive both of them. Errors could go through it as well, and
+    // requests through a similar one, which would remove the circular dependency
+    // entirely.
     return ret;
 }
@@ -1,14 +1,25 @@
 #include <iostream>
 #include <QAbstractItemView>
+#include <array>
 #include <atomic>
 #include <algorithm>
+#include <chrono>
+#include <ranges>
 #include <QFileDialog>
 #include <QMessageBox>
-#include <fstream>
+#include <cerrno>
+#include <cstring>
 #include <QWebEngineScript>
 #include <QWebEngineScriptCollection>
 
+#include <fcntl.h>
+#include <unistd.h>
+
 #include "mainwindow.h"
+#include "issue_keys.hh"
+#include "lru_cache.hh"
+#include "render_cache.hh"
+#include "protocol.hh"
 #include "utils.hh"
 #include "./ui_mainwindow.h"
 
@@ -19,47 +30,235 @@ namespace {
     // it could be put there.
     // Doesn't need to be an incremented number of request, a randomly generated token
     // would also suffice
-    std::atomic<int> nr_request = 0;
+    std::atomic<std::uint64_t> nr_request = 1; // 0 means "no request"
 }
 
 
 namespace {
-    struct kv_pair { // could use std::pair, but nicer to have names
-        std::string key;
-        std::string value;
+    auto to_qstring(const byte_slice& data) -> QString {
+        return QString::fromUtf8(reinterpret_cast<const char *>(data.data()), static_cast<qsizetype>(data.size()));
+    }
 
-        kv_pair(std::string k, std::string v) noexcept
-                : key(std::move(k))
-                , value(std::move(v))
-        {
+    auto to_qstring(std::string_view s) -> QString {
+        return QString::fromUtf8(s.data(), static_cast<qsizetype>(s.size()));
+    }
+
+    // Raw bytes are wrapped without copy, they stay alive as long as the reply. Base64 text is
+    // decoded straight into the byte array.
+    auto to_qbytearray(const protocol::binary_payload& payload) -> std::expected<QByteArray, std::string> {
+        if (payload.encoding == payload_encoding::raw_bytes) {
+            const auto& bytes = payload.bytes;
+            return QByteArray::fromRawData(reinterpret_cast<const char *>(bytes.data()), static_cast<qsizetype>(bytes.size()));
+        }
+        QByteArray res(static_cast<qsizetype>(payload.size()), Qt::Uninitialized);
+        if (auto decoded = payload.decode_into(std::span(reinterpret_cast<std::uint8_t*>(res.data()), static_cast<size_t>(res.size())));
+            !decoded.has_value()) {
+            return std::unexpected(std::move(decoded.error()));
         }
+        return res;
+    }
+
+    // Results prepared by the decode workers for each kind of request. The UI thread only has
+    // to put them into widgets.
+    using issue_list_result = std::expected<QStringList, std::string>;
+    struct page_view {
+        QByteArray html;
+        std::uint64_t content_hash; // see protocol::content_hash
+    };
+    using ticket_page_result = std::expected<page_view, std::string>;
+    // Property names are always interned. Values are only interned for these fields, whose values
+    // come from a small set shared by the tickets. Other values, even short ones like dates, are
+    // mostly unique to their ticket and would make the string table grow for as long as the
+    // application runs.
+    constexpr std::array<std::string_view, 7> fields_with_interned_values = {
+        "assignee", "issuetype", "priority", "project", "reporter", "resolution", "status",
     };
+    auto has_interned_values(std::string_view key) noexcept -> bool {
+        return std::ranges::find(fields_with_interned_values, key) != fields_with_interned_values.end();
+    }
 
-    auto split_into_key_value_array(const std::string &input) -> std::vector<kv_pair> {
-        std::istringstream ss{input};
-        std::vector<std::string> props;
-        std::string tmp;
-        while (std::getline(ss, tmp, ',')) {
-            props.emplace_back(std::move(tmp));
-        }
-
-        std::vector<kv_pair> res;
-        res.reserve(props.size());
-        for (const auto &kv: props) {
-            const auto colon_pos = std::find(kv.cbegin(), kv.cend(), ':');
-            if (colon_pos == kv.cend()) {
-                std::cout << std::format(
-                        "Error: invalid encoded data found. Expected a key value pair separated by a colon. Got {}",
-                        kv);
-            } else {
-                auto key = std::string(kv.cbegin(), colon_pos);
-                auto value = std::string(std::next(colon_pos), kv.cend());
-                res.emplace_back(std::move(key), std::move(value));
+    struct property_row {
+        interned_string key;
+        QString value; // shares its storage with the other tickets' when interned
+    };
+    using properties_result = std::expected<std::vector<property_row>, std::string>;
+    struct attachment_row {
+        std::string uuid;
+        std::string filename;
+    };
+    using attachments_result = std::expected<std::vector<attachment_row>, std::string>;
+    using download_result = std::expected<void, std::string>;
+
+    // tabs of main_view_widget
+    constexpr int ticket_view_tab = 0;
+    constexpr int properties_tab = 1;
+    constexpr int attachments_tab = 2;
+
+    // pages of the tickets this far from the selected one in the issue list are prefetched,
+    // properties only for the closest ones
+    constexpr int prefetch_radius = 3;
+    constexpr int prefetch_properties_radius = 1;
+    // how long the selection must stay the same before prefetching
+    constexpr std::chrono::milliseconds prefetch_delay(250);
+
+    // keys of the render cache, which keeps what is shown at startup
+    constexpr std::string_view issue_list_cache_key = "issue-list"; // sorted issues, one per line
+    constexpr std::string_view last_viewed_cache_key = "last-viewed";
+    auto ticket_page_cache_key(std::string_view issue) -> std::string {
+        return std::format("html:{}", issue);
+    }
+
+    auto prepare_issue_list(std::expected<protocol::ticket_list, std::string> decoded, render_cache* disk_cache) -> issue_list_result {
+        if (!decoded.has_value()) {
+            return std::unexpected(std::move(decoded.error()));
+        }
+        const auto& issues = decoded->keys;
+        const std::vector<std::string_view> keys(issues.begin(), issues.end());
+        const auto order = sorted_issue_order(keys);
+
+        QStringList res;
+        res.reserve(static_cast<qsizetype>(issues.size()));
+        std::string cached;
+        for (const auto index : order) {
+            res.append(to_qstring(keys[index]));
+            if (disk_cache != nullptr) {
+                cached += keys[index];
+                cached += '\n';
+            }
+        }
+        if (disk_cache != nullptr) {
+            if (auto stored = disk_cache->store(issue_list_cache_key, cached); !stored.has_value()) {
+                std::cout << std::format("Error: failed to cache the issue list: {}\n", stored.error());
             }
         }
         return res;
     }
 
+    auto page_content_hash(const QByteArray& html) noexcept -> std::uint64_t {
+        return protocol::content_hash(std::span(reinterpret_cast<const std::uint8_t*>(html.constData()), static_cast<size_t>(html.size())));
+    }
+
+    auto store_ticket_page(render_cache& disk_cache, const std::string& issue, const QByteArray& html) -> void {
+        const auto bytes = std::string_view(html.constData(), static_cast<size_t>(html.size()));
+        if (auto stored = disk_cache.store(ticket_page_cache_key(issue), bytes); !stored.has_value()) {
+            std::cout << std::format("Error: failed to cache the page of {}: {}\n", issue, stored.error());
+        }
+    }
+
+    // disk_cache is null for prefetched pages, they are only stored once the user opens them
+    auto prepare_ticket_page(std::expected<protocol::ticket_page, std::string> decoded, const std::string& issue, render_cache* disk_cache) -> ticket_page_result {
+        auto html = decoded.and_then([](const protocol::ticket_page& page) { return to_qbytearray(page.html); });
+        if (!html.has_value()) {
+            return std::unexpected(std::move(html.error()));
+        }
+        if (disk_cache != nullptr) {
+            store_ticket_page(*disk_cache, issue, html.value());
+        }
+        // hashed here rather than on the UI thread, pages can be megabytes long
+        const auto hash = page_content_hash(html.value());
+        return page_view{ .html = std::move(html.value()), .content_hash = hash };
+    }
+
+    auto prepare_properties(std::expected<protocol::ticket_properties, std::string> decoded, string_table& strings) -> properties_result {
+        if (!decoded.has_value()) {
+            std::cout << std::format("Error: {}\n", decoded.error());
+            return std::unexpected(std::move(decoded.error()));
+        }
+        auto& properties = decoded->properties;
+        std::sort(properties.begin(), properties.end(), [](const auto& a, const auto& b){
+            return a.key < b.key;
+        });
+
+        std::vector<property_row> res;
+        res.reserve(properties.size());
+        for (const auto& elt : properties) {
+            auto value = has_interned_values(elt.key) ? strings.intern(elt.value).text : to_qstring(elt.value);
+            res.emplace_back(strings.intern(elt.key), std::move(value));
+        }
+        // the valid properties are still shown, with a row for each pair which failed to decode
+        for (const auto& error : decoded->errors) {
+            std::cout << std::format("Error with encoded key/value. Key={} Value={}. {}\n", error.key, error.value, error.reason);
+            res.emplace_back(strings.intern("Error with encoded key/value"),
+                             QString::fromStdString(std::format("Key={} Value={}. {}", error.key, error.value, error.reason)));
+        }
+        return res;
+    }
+
+    auto prepare_attachments(std::expected<protocol::attachment_list, std::string> decoded) -> attachments_result {
+        if (!decoded.has_value()) {
+            std::cout << std::format("Error: {}\n", decoded.error());
+            return std::unexpected(std::move(decoded.error()));
+        }
+        for (const auto& error : decoded->errors) {
+            std::cout << std::format("Error with encoded filename, attachment skipped. uuid={} encoded_value={}. {}\n",
+                                     error.key, error.value, error.reason);
+        }
+        auto& attachments = decoded->attachments;
+        std::sort(attachments.begin(), attachments.end(), [](const auto& a, const auto& b){
+            return a.filename < b.filename;
+        });
+
+        std::vector<attachment_row> res;
+        res.reserve(attachments.size());
+        for (const auto& elt : attachments) {
+            res.emplace_back(std::string(elt.uuid), std::string(elt.filename));
+        }
+        return res;
+    }
+
+    // written as it gets decoded, big files are never held in memory as a whole
+    auto save_attachment(const std::expected<protocol::attachment_content, std::string>& decoded, const std::string& filename) -> download_result {
+        if (!decoded.has_value()) {
+            return std::unexpected(decoded.error());
+        }
+        const auto fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if (fd == -1) {
+            return std::unexpected(std::format("failed to open the file. Err is {}: {}", errno, strerror(errno)));
+        }
+        auto written = decoded->data.write_to(fd);
+        if ((::close(fd) == -1) && written.has_value()) {
+            written = std::unexpected(std::format("close failed. Err is {}: {}", errno, strerror(errno)));
+        }
+        return written;
+    }
+
+    // Decoded views of the recently viewed tickets are kept in MainWindow::view_cache, under a
+    // key made of the tab and the issue. Sizes are estimates of the memory held.
+    auto view_cache_key(int tab, std::string_view issue) -> std::string {
+        return std::format("{}:{}", tab, issue);
+    }
+
+    // A view is up to date when fetched since the latest synchronisation, see
+    // MainWindow::view_generation. Older ones are still shown while being checked again.
+    template <typename View>
+    struct cached_view {
+        View view;
+        std::uint64_t generation;
+    };
+
+    template <typename T>
+    auto find_cached(lru_cache<std::any>& cache, int tab, std::string_view issue) -> cached_view<T>* {
+        auto* const cached = cache.find(view_cache_key(tab, issue));
+        return (cached == nullptr) ? nullptr : std::any_cast<cached_view<T>>(cached);
+    }
+
+    auto cached_size(const std::vector<property_row>& rows) -> size_t {
+        // keys and the values of some fields are shared with the string table, count them anyway
+        size_t res = rows.size() * sizeof(property_row);
+        for (const auto& row : rows) {
+            res += static_cast<size_t>(row.value.size()) * sizeof(QChar);
+        }
+        return res;
+    }
+
+    auto cached_size(const std::vector<attachment_row>& rows) -> size_t {
+        size_t res = rows.size() * sizeof(attachment_row);
+        for (const auto& row : rows) {
+            res += row.uuid.size() + row.filename.size();
+        }
+        return res;
+    }
+
     struct AttachmentItem : public QListWidgetItem {
         AttachmentItem(std::string u, std::string f)
                 : QListWidgetItem(QString::fromStdString(f))
@@ -71,6 +270,31 @@ namespace {
         std::string uuid = {};
         std::string filename = {};
     };
+
+    void show_properties(QTableWidget& properties_widget, const std::vector<property_row>& rows) {
+        properties_widget.clearContents();
+        const auto nr_rows = rows.size();
+        properties_widget.setRowCount(static_cast<int>(nr_rows));
+
+        for (size_t i = 0; i < nr_rows; ++i) {
+            const auto& elt = rows[i];
+            properties_widget.setItem(static_cast<int>(i), 0, new QTableWidgetItem(elt.key.text));
+            properties_widget.setItem(static_cast<int>(i), 1, new QTableWidgetItem(elt.value));
+        }
+    }
+
+    void show_attachments(QListWidget& attachments_widget, const std::vector<attachment_row>& rows) {
+        attachments_widget.clear();
+        if (rows.empty()) {
+            attachments_widget.setEnabled(false);
+            attachments_widget.addItem(QString("This ticket has no attachment"));
+            return;
+        }
+        attachments_widget.setEnabled(true);
+        for (const auto& uuid_fname : rows) {
+            attachments_widget.addItem(new AttachmentItem(uuid_fname.uuid, uuid_fname.filename));
+        }
+    }
 }
 
 namespace {
@@ -615,18 +839,25 @@ namespace {
     }
 }
 
-MainWindow::MainWindow(ProgHandler& server_handle, QWidget *parent)
+MainWindow::MainWindow(ProgHandler& server_handle, decode_pipeline& reply_decoders, string_table& strings, size_t view_cache_budget,
+                       size_t prefetch_budget, render_cache* previous_runs_cache, QWidget *parent)
     : QMainWindow(parent)
     , ui(std::make_unique<Ui::MainWindow>())
     , server_handler(server_handle)
+    , decoders(reply_decoders)
+    , shared_strings(strings)
+    , disk_cache(previous_runs_cache)
+    , view_cache(view_cache_budget)
+    , prefetch_cache(prefetch_budget)
+    , prefetch_enabled(prefetch_budget != 0)
 {
     ui->setupUi(this);
     ui->issues_list->addItem(QString("Loading issues list"));
     set_css(ui->html_page_widget);
     set_start_page(ui->html_page_widget);
-    ui->main_view_widget->setTabText(0, QString("Loading tickets"));
-    ui->main_view_widget->setTabText(1, QString("properties"));
-    ui->main_view_widget->setTabText(2, QString("attachments"));
+    ui->main_view_widget->setTabText(ticket_view_tab, QString("Loading tickets"));
+    ui->main_view_widget->setTabText(properties_tab, QString("properties"));
+    ui->main_view_widget->setTabText(attachments_tab, QString("attachments"));
 
 //    ui->properties_widget->setContextMenuPolicy(Qt::ContextMenuPolicy::ActionsContextMenu);
     ui->attachments_widget->setSortingEnabled(true);
@@ -638,25 +869,99 @@ MainWindow::MainWindow(ProgHandler& server_handle, QWidget *parent)
     QObject::connect(ui->attachments_widget, SIGNAL(itemDoubleClicked(QListWidgetItem *)), this, SLOT(download_file_activated(QListWidgetItem *)));
     QObject::connect(ui->synchroniseProjects, SIGNAL(clicked()), this, SLOT(do_on_synchronise_projects_clicked()));
     QObject::connect(ui->fullResetProjects, SIGNAL(clicked()), this, SLOT(do_on_full_projects_reset_clicked()));
+    QObject::connect(ui->main_view_widget, SIGNAL(currentChanged(int)), this, SLOT(do_on_tab_changed(int)));
+    prefetch_timer.setSingleShot(true);
+    prefetch_timer.setInterval(prefetch_delay);
+    QObject::connect(&prefetch_timer, SIGNAL(timeout()), this, SLOT(do_on_prefetch_timeout()));
 
+    ui->main_view_widget->setCurrentIndex(ticket_view_tab);
+    show_previous_run();
     start_issue_list_request();
-    ui->main_view_widget->setCurrentIndex(0);
+}
+
+MainWindow::~MainWindow() {
+    // written once here rather than at every click, which would make the UI thread wait for the file
+    if ((disk_cache != nullptr) && (!selected_issue.empty())) {
+        [[maybe_unused]] const auto stored = disk_cache->store(last_viewed_cache_key, selected_issue);
+    }
+}
+
+void MainWindow::show_previous_run() {
+    if (disk_cache == nullptr) {
+        return;
+    }
+    const auto issues = disk_cache->find(issue_list_cache_key);
+    if (!issues.has_value() || issues->empty()) {
+        return;
+    }
+    QStringList issue_list;
+    for (const auto issue : std::views::split(issues.value(), '\n')) {
+        if (!issue.empty()) {
+            issue_list.append(to_qstring(std::string_view(issue)));
+        }
+    }
+    ui->issues_list->clear();
+    ui->issues_list->addItems(issue_list);
+    set_tickets_finished_loaded_page(ui->html_page_widget);
+    first_ticket_loaded = true;
+
+    const auto last_viewed = disk_cache->find(last_viewed_cache_key);
+    if (!last_viewed.has_value()) {
+        return;
+    }
+    const auto html = disk_cache->find(ticket_page_cache_key(last_viewed.value()));
+    if (!html.has_value()) {
+        return;
+    }
+    selected_issue = std::string(last_viewed.value());
+    ui->main_view_widget->setTabText(ticket_view_tab, to_qstring(selected_issue));
+    if (const auto items = ui->issues_list->findItems(to_qstring(selected_issue), Qt::MatchExactly); !items.empty()) {
+        ui->issues_list->setCurrentItem(items.front());
+    }
+    // the cache lives longer than the window, no need to copy the page. Being older than any
+    // synchronisation, it is shown then checked with the server like a stale view
+    auto page = QByteArray::fromRawData(html->data(), static_cast<qsizetype>(html->size()));
+    const auto hash = page_content_hash(page);
+    view_cache.insert(view_cache_key(ticket_view_tab, selected_issue),
+                      cached_view<page_view>{ .view = { .html = std::move(page), .content_hash = hash }, .generation = 0 }, html->size());
+    load_current_tab();
+    schedule_prefetch();
 }
 
 auto MainWindow::do_on_synchronise_projects_clicked() -> void {
-    this->synchronise_projects_request = std::string{"synchronise-projects-"} + std::to_string(nr_request++);
-    const auto request = this->synchronise_projects_request + " SYNCHRONISE_UPDATED\n";
     ui->synchroniseProjects->setEnabled(false);
     ui->synchroniseProjects->setText(QString("synchronising projects..."));
-    server_handler.send_to_child(request);
+
+    const auto restore_button = [this]() {
+        ui->synchroniseProjects->setEnabled(true);
+        ui->synchroniseProjects->setText("synchronise projects");
+    };
+    const auto request_number = next_request_number();
+    send_request(request_number, protocol::make_request({"synchronise-projects", request_number}, protocol::synchronise_updated{}),
+                 [this](decoded_reply& reply) { handle_synchronise_projects_reply(reply.msg); },
+                 [this, restore_button](const std::string& reason) {
+                     restore_button();
+                     do_on_server_error(std::format("failed to synchronise projects: {}", reason));
+                 },
+                 request_priority::background);
 }
 
 auto MainWindow::do_on_full_projects_reset_clicked() -> void {
-    this->full_reset_request = std::string{"synchronise-all-"} + std::to_string(nr_request++);
-    const auto request = this->full_reset_request + " SYNCHRONISE_ALL\n";
     ui->fullResetProjects->setEnabled(false);
     ui->fullResetProjects->setText(QString("full reset ongoing..."));
-    server_handler.send_to_child(request);
+
+    const auto restore_button = [this]() {
+        ui->fullResetProjects->setEnabled(true);
+        ui->fullResetProjects->setText("Full projects reset");
+    };
+    const auto request_number = next_request_number();
+    send_request(request_number, protocol::make_request({"synchronise-all", request_number}, protocol::synchronise_all{}),
+                 [this](decoded_reply& reply) { handle_full_reset_reply(reply.msg); },
+                 [this, restore_button](const std::string& reason) {
+                     restore_button();
+                     do_on_server_error(std::format("failed to reset projects: {}", reason));
+                 },
+                 request_priority::background);
 }
 
 auto MainWindow::download_file_activated(QListWidgetItem* selected) -> void {
@@ -667,26 +972,75 @@ auto MainWindow::download_file_activated(QListWidgetItem* selected) -> void {
                                                             QString::fromStdString(fname));
         if (!save_path.isEmpty()) {
             const auto& uuid = item->uuid;
-            const auto request = std::format("dl-for-{}-{}", uuid, nr_request++);
-            files_to_download.emplace_back(save_path.toStdString(), request);
-            server_handler.send_to_child(std::format("{} FETCH_ATTACHMENT_CONTENT {}\n", request, uuid));
+            // several downloads can be in flight, each reply handler knows where to save its file
+            auto filename = save_path.toStdString();
+            const auto request_number = next_request_number();
+            const auto request_name = std::format("dl-for-{}", uuid);
+            send_request(request_number, protocol::make_request({request_name, request_number}, protocol::fetch_attachment_content{uuid}),
+                         [this, filename](decoded_reply& reply) { handle_download_msg_reply(reply, filename); },
+                         [this, filename](const std::string& reason) {
+                             do_on_server_error(std::format("failed to request the content of file {}: {}", filename, reason));
+                         },
+                         request_priority::bulk,
+                         make_result_decoder<protocol::fetch_attachment_content>([filename](const auto& decoded) {
+                             return save_attachment(decoded, filename);
+                         }));
         }
     }
 }
 
 void MainWindow::start_issue_list_request() {
-    this->issue_list_request = std::string{"issue-ticket-list-"} + std::to_string(nr_request++);
-    const auto request = this->issue_list_request + " FETCH_TICKET_LIST\n";
-    server_handler.send_to_child(request);
+    const auto request_number = next_request_number();
+    auto request = protocol::make_request({"issue-ticket-list", request_number}, protocol::fetch_ticket_list{});
+    replace_view_request(issue_list_request, request_number, protocol::get_request_id(request));
+    send_request(request_number, std::move(request),
+                 [this, request_number](decoded_reply& reply) {
+                     // a newer list was requested in the meantime
+                     if (request_number == issue_list_request.number) {
+                         handle_issue_list_reply(reply);
+                     }
+                 },
+                 [this](const std::string& reason) {
+                     do_on_server_error(std::format("failed to request the list of tickets: {}", reason));
+                 },
+                 request_priority::interactive,
+                 make_result_decoder<protocol::fetch_ticket_list>([disk_cache = disk_cache](std::expected<protocol::ticket_list, std::string> decoded) {
+                     return prepare_issue_list(std::move(decoded), disk_cache);
+                 }));
 }
 
-void MainWindow::start_ticket_view_request(const std::string& issue_name) {
-    const auto html = "<html><head></head><body><h1>Loading data for issue " + issue_name + "</h1></body></html>";
-    ui->html_page_widget->setContent(html.c_str(), "text/html;charset=UTF-8");
+void MainWindow::start_ticket_view_request(const std::string& issue_name, bool show_loading_page, std::optional<std::uint64_t> known_hash) {
+    if (show_loading_page) {
+        const auto html = "<html><head></head><body><h1>Loading data for issue " + issue_name + "</h1></body></html>";
+        ui->html_page_widget->setContent(html.c_str(), "text/html;charset=UTF-8");
+    }
 
-    this->ticket_view_request = issue_name + "-fetch-html-" + std::to_string(nr_request++);
-    const auto fetch_html_request = this->ticket_view_request + " FETCH_TICKET " + issue_name + ",HTML\n";
-    server_handler.send_to_child(fetch_html_request);
+    const auto request_number = next_request_number();
+    const auto is_conditional = known_hash.has_value() && server_knows_conditional_fetch;
+    const auto request_name = issue_name + "-fetch-html";
+    const protocol::request_id id = {request_name, request_number};
+    auto request = is_conditional ? protocol::make_request(id, protocol::fetch_ticket_if_modified{issue_name, protocol::content_hash_text(known_hash.value())})
+                                  : protocol::make_request(id, protocol::fetch_ticket{issue_name});
+    replace_view_request(ticket_view_request, request_number, protocol::get_request_id(request));
+    send_request(request_number, std::move(request),
+                 [this, request_number, is_conditional](decoded_reply& reply) {
+                     // the user selected another ticket in the meantime
+                     if (request_number == ticket_view_request.number) {
+                         handle_ticket_view_reply(reply, is_conditional);
+                     }
+                 },
+                 [this, request_number](const std::string& reason) {
+                     if (request_number == ticket_view_request.number) {
+                         ticket_view_request = {};
+                         ticket_view_issue = {};
+                         ui->html_page_widget->setHtml(QString("Failed to request the ticket from the server: ").append(reason.c_str()));
+                     }
+                 },
+                 request_priority::interactive,
+                 // both commands have the same result
+                 make_result_decoder<protocol::fetch_ticket>([issue_name, disk_cache = disk_cache](std::expected<protocol::ticket_page, std::string> decoded) {
+                     return prepare_ticket_page(std::move(decoded), issue_name, disk_cache);
+                 }));
 }
 
 void MainWindow::start_ticket_properties_request(const std::string& issue_name) {
@@ -697,9 +1051,30 @@ void MainWindow::start_ticket_properties_request(const std::string& issue_name)
     ui->properties_widget->setItem(0, 0, new QTableWidgetItem(QString("Loading properties for")));
     ui->properties_widget->setItem(0, 1, new QTableWidgetItem(QString(" ticket ").append(issue_name_as_c_str)));
 
-    this->ticket_properties_request = issue_name + "-fetch-key-value-list-" + std::to_string(nr_request++);
-    const auto request = this->ticket_properties_request + " FETCH_TICKET_KEY_VALUE_FIELDS " + issue_name + "\n";
-    server_handler.send_to_child(request);
+    const auto request_number = next_request_number();
+    auto request = protocol::make_request({issue_name + "-fetch-key-value-list", request_number}, protocol::fetch_ticket_key_value_fields{issue_name});
+    replace_view_request(ticket_properties_request, request_number, protocol::get_request_id(request));
+    send_request(request_number, std::move(request),
+                 [this, request_number](decoded_reply& reply) {
+                     if (request_number == ticket_properties_request.number) {
+                         handle_ticket_properties_reply(reply);
+                     }
+                 },
+                 [this, request_number](const std::string& reason) {
+                     if (request_number == ticket_properties_request.number) {
+                         ticket_properties_request = {};
+                         ticket_properties_issue = {};
+                         ui->properties_widget->clearContents();
+                         ui->properties_widget->setRowCount(1);
+                         ui->properties_widget->setItem(0, 0, new QTableWidgetItem(QString("Failed to request properties")));
+                         ui->properties_widget->setItem(0, 1, new QTableWidgetItem(QString::fromStdString(reason)));
+                     }
+                 },
+                 request_priority::interactive,
+                 make_result_decoder<protocol::fetch_ticket_key_value_fields>(
+                     [&strings = shared_strings](std::expected<protocol::ticket_properties, std::string> decoded) {
+                         return prepare_properties(std::move(decoded), strings);
+                     }));
 }
 
 void MainWindow::start_ticket_attachment_request(const std::string& issue_name) {
@@ -711,17 +1086,237 @@ void MainWindow::start_ticket_attachment_request(const std::string& issue_name)
     ui->attachments_widget->clear();
     ui->attachments_widget->addItem(QString("Loading attachments for ").append(issue_name_as_c_str));
 
-    this->ticket_attachments_request = issue_name + "-fetch-attachment-list-" + std::to_string(nr_request++);
-    const auto request = this->ticket_attachments_request + " FETCH_ATTACHMENT_LIST_FOR_TICKET " + issue_name + "\n";
-    server_handler.send_to_child(request);
+    const auto request_number = next_request_number();
+    auto request = protocol::make_request({issue_name + "-fetch-attachment-list", request_number}, protocol::fetch_attachment_list_for_ticket{issue_name});
+    replace_view_request(ticket_attachments_request, request_number, protocol::get_request_id(request));
+    send_request(request_number, std::move(request),
+                 [this, request_number](decoded_reply& reply) {
+                     if (request_number == ticket_attachments_request.number) {
+                         handle_ticket_attachment_reply(reply);
+                     }
+                 },
+                 [this, request_number](const std::string& reason) {
+                     if (request_number == ticket_attachments_request.number) {
+                         ticket_attachments_request = {};
+                         ticket_attachments_issue = {};
+                         ui->attachments_widget->clear();
+                         ui->attachments_widget->addItem(QString("Failed to request attachments: ").append(reason.c_str()));
+                     }
+                 },
+                 request_priority::interactive,
+                 make_result_decoder<protocol::fetch_attachment_list_for_ticket>(prepare_attachments));
 }
 
 void MainWindow::refresh_ticket(const std::string& issue_name) {
-    ui->main_view_widget->setTabText(0, QString::fromStdString(issue_name));
+    ui->main_view_widget->setTabText(ticket_view_tab, QString::fromStdString(issue_name));
+
+    // clicking the selected issue again reloads it from the server. Hidden tabs are loaded once shown
+    if (issue_name == selected_issue) {
+        view_cache.erase(view_cache_key(ticket_view_tab, issue_name));
+        view_cache.erase(view_cache_key(properties_tab, issue_name));
+        view_cache.erase(view_cache_key(attachments_tab, issue_name));
+    }
+    selected_issue = issue_name;
+    cancel_view_request(ticket_view_request);
+    cancel_view_request(ticket_properties_request);
+    cancel_view_request(ticket_attachments_request);
+    ticket_view_issue = {};
+    ticket_properties_issue = {};
+    ticket_attachments_issue = {};
+    load_current_tab();
+    schedule_prefetch();
+}
+
+void MainWindow::load_current_tab() {
+    if (selected_issue.empty()) {
+        return;
+    }
+    switch (ui->main_view_widget->currentIndex()) {
+        case ticket_view_tab:
+            if (ticket_view_issue != selected_issue) {
+                ticket_view_issue = selected_issue;
+                adopt_prefetched_view(ticket_view_tab, selected_issue);
+                if (const auto* page = find_cached<page_view>(view_cache, ticket_view_tab, selected_issue); page != nullptr) {
+                    ui->html_page_widget->setContent(page->view.html, "text/html;charset=UTF-8");
+                    if (page->generation != view_generation) {
+                        // most of the time the page didn't change, and the server only says so
+                        start_ticket_view_request(selected_issue, false, page->view.content_hash);
+                    }
+                } else {
+                    start_ticket_view_request(selected_issue);
+                }
+            }
+            break;
+        case properties_tab:
+            if (ticket_properties_issue != selected_issue) {
+                ticket_properties_issue = selected_issue;
+                adopt_prefetched_view(properties_tab, selected_issue);
+                // properties and attachments are small, stale ones are fetched again as a whole
+                if (const auto* rows = find_cached<std::vector<property_row>>(view_cache, properties_tab, selected_issue);
+                    (rows != nullptr) && (rows->generation == view_generation)) {
+                    show_properties(*ui->properties_widget, rows->view);
+                } else {
+                    start_ticket_properties_request(selected_issue);
+                }
+            }
+            break;
+        case attachments_tab:
+            if (ticket_attachments_issue != selected_issue) {
+                ticket_attachments_issue = selected_issue;
+                if (const auto* rows = find_cached<std::vector<attachment_row>>(view_cache, attachments_tab, selected_issue);
+                    (rows != nullptr) && (rows->generation == view_generation)) {
+                    show_attachments(*ui->attachments_widget, rows->view);
+                    nr_attachment_for_ticket = rows->view.size();
+                } else {
+                    start_ticket_attachment_request(selected_issue);
+                }
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+void MainWindow::invalidate_ticket_views() {
+    // the server doesn't tell which tickets changed. Cached views are kept, pages can be checked
+    // without being transferred again
+    ++view_generation;
+    // prefetched before the synchronisation, they might be out of date too
+    cancel_prefetch_requests();
+    prefetch_cache.clear();
+    ticket_properties_issue = {};
+    ticket_attachments_issue = {};
+    const auto* page = find_cached<page_view>(view_cache, ticket_view_tab, ticket_view_issue);
+    if ((page != nullptr) && (ui->main_view_widget->currentIndex() == ticket_view_tab)) {
+        // the page shown stays as is, the server is only asked whether it changed
+        start_ticket_view_request(ticket_view_issue, false, page->view.content_hash);
+    } else {
+        ticket_view_issue = {};
+    }
+    load_current_tab();
+    schedule_prefetch();
+}
+
+auto MainWindow::do_on_tab_changed(int /*index*/) -> void {
+    load_current_tab();
+}
+
+void MainWindow::schedule_prefetch() {
+    if (prefetch_enabled) {
+        prefetch_timer.start(); // restarted when already running
+    }
+}
+
+auto MainWindow::do_on_prefetch_timeout() -> void {
+    if ((ticket_view_request.number != 0) || (ticket_properties_request.number != 0) || (ticket_attachments_request.number != 0)) {
+        // the user is still waiting for the selected ticket
+        schedule_prefetch();
+        return;
+    }
+    prefetch_neighbours();
+}
+
+void MainWindow::prefetch_neighbours() {
+    const auto row = ui->issues_list->currentRow();
+    if (selected_issue.empty() || (row < 0)) {
+        return;
+    }
+    struct wanted_view {
+        int tab;
+        std::string issue;
+        std::string key;
+    };
+    // closest first, the writer thread sends requests of the same priority in order
+    std::vector<wanted_view> wanted;
+    for (int distance = 1; distance <= prefetch_radius; ++distance) {
+        for (const auto neighbour_row : {row + distance, row - distance}) {
+            const auto* const item = ui->issues_list->item(neighbour_row);
+            if (item == nullptr) {
+                continue;
+            }
+            const auto issue = item->text().toStdString();
+            wanted.push_back({ .tab = ticket_view_tab, .issue = issue, .key = view_cache_key(ticket_view_tab, issue) });
+            if (distance <= prefetch_properties_radius) {
+                wanted.push_back({ .tab = properties_tab, .issue = issue, .key = view_cache_key(properties_tab, issue) });
+            }
+        }
+    }
+
+    // the user moved on, what was prefetched around the previous selection isn't needed anymore
+    for (auto it = prefetch_requests.begin(); it != prefetch_requests.end();) {
+        if (std::ranges::find(wanted, it->first, &wanted_view::key) != wanted.end()) {
+            ++it;
+        } else {
+            cancel_view_request(it->second);
+            it = prefetch_requests.erase(it);
+        }
+    }
+
+    for (const auto& view : wanted) {
+        if (!view_cache.contains(view.key) && !prefetch_cache.contains(view.key) && !prefetch_requests.contains(view.key)) {
+            start_prefetch_request(view.tab, view.issue);
+        }
+    }
+}
+
+void MainWindow::start_prefetch_request(int tab, const std::string& issue_name) {
+    const auto request_number = next_request_number();
+    const auto key = view_cache_key(tab, issue_name);
+    auto request = (tab == ticket_view_tab)
+        ? protocol::make_request({issue_name + "-prefetch-html", request_number}, protocol::fetch_ticket{issue_name})
+        : protocol::make_request({issue_name + "-prefetch-key-value-list", request_number}, protocol::fetch_ticket_key_value_fields{issue_name});
+    auto decoder = (tab == ticket_view_tab)
+        ? make_result_decoder<protocol::fetch_ticket>([issue_name](std::expected<protocol::ticket_page, std::string> decoded) {
+              return prepare_ticket_page(std::move(decoded), issue_name, nullptr);
+          })
+        : make_result_decoder<protocol::fetch_ticket_key_value_fields>(
+              [&strings = shared_strings](std::expected<protocol::ticket_properties, std::string> decoded) {
+                  return prepare_properties(std::move(decoded), strings);
+              });
 
-    start_ticket_attachment_request(issue_name);
-    start_ticket_properties_request(issue_name);
-    start_ticket_view_request(issue_name);
+    prefetch_requests.insert_or_assign(key, view_request{.number = request_number, .id = std::string(protocol::get_request_id(request))});
+    ++nr_prefetch_requested;
+    send_request(request_number, std::move(request),
+                 [this, key, request_number](decoded_reply& reply) { handle_prefetch_reply(reply, key, request_number); },
+                 [this, key, request_number](const std::string& /*reason*/) {
+                     // nobody waits for it, the view is requested again if the user selects it
+                     if (const auto it = prefetch_requests.find(key); (it != prefetch_requests.end()) && (it->second.number == request_number)) {
+                         prefetch_requests.erase(it);
+                     }
+                 },
+                 request_priority::background,
+                 std::move(decoder));
+}
+
+void MainWindow::cancel_prefetch_requests() {
+    for (auto& [key, request] : prefetch_requests) {
+        cancel_view_request(request);
+    }
+    prefetch_requests.clear();
+}
+
+void MainWindow::adopt_prefetched_view(int tab, const std::string& issue_name) {
+    const auto key = view_cache_key(tab, issue_name);
+    if (auto* const prefetched = prefetch_cache.find(key); prefetched != nullptr) {
+        if (const auto* page = std::any_cast<cached_view<page_view>>(&prefetched->view); (page != nullptr) && (disk_cache != nullptr)) {
+            store_ticket_page(*disk_cache, issue_name, page->view.html);
+        }
+        view_cache.insert(key, std::move(prefetched->view), prefetched->nr_bytes);
+        prefetch_cache.erase(key);
+    } else if (const auto it = prefetch_requests.find(key); it != prefetch_requests.end()) {
+        // the user got there first. The view gets requested again at interactive priority
+        cancel_view_request(it->second);
+        prefetch_requests.erase(it);
+    }
+}
+
+auto MainWindow::prefetcher_stats() const noexcept -> prefetch_stats {
+    const auto cache_stats = prefetch_cache.stats();
+    return {
+        .nr_requested = nr_prefetch_requested,
+        .nr_served = cache_stats.nr_hits, // only looked up when the view is shown
+        .cache = cache_stats,
+    };
 }
 
 void MainWindow::jira_issue_activated(QListWidgetItem* selected)
@@ -739,252 +1334,270 @@ void MainWindow::jira_issue_activated(QListWidgetItem* selected)
     }
 }
 
-auto MainWindow::handle_synchronise_projects_reply(const std::string& s) -> void {
-    if (s == synchronise_projects_request + " FINISHED\n") {
+auto MainWindow::handle_synchronise_projects_reply(const server_message& msg) -> void {
+    if (msg.kind == reply_kind::finished) {
         ui->synchroniseProjects->setEnabled(true);
         ui->synchroniseProjects->setText("synchronise projects");
-        synchronise_projects_request.clear();
         start_issue_list_request(); // update the ticket list on the left pane
-    } else if (s == synchronise_projects_request + " ACK\n") {
+        invalidate_ticket_views();
+    } else if (msg.kind == reply_kind::ack) {
         // nothing to do
     }
 }
 
-auto MainWindow::handle_full_reset_reply(const std::string& s) -> void {
-    if (s == full_reset_request + " FINISHED\n") {
+auto MainWindow::handle_full_reset_reply(const server_message& msg) -> void {
+    if (msg.kind == reply_kind::finished) {
         ui->fullResetProjects->setEnabled(true);
         ui->fullResetProjects->setText("Full projects reset");
-        full_reset_request.clear();
         start_issue_list_request(); // update the ticket list on the left pane
-    } else if (s == full_reset_request + " ACK\n") {
+        invalidate_ticket_views();
+    } else if (msg.kind == reply_kind::ack) {
         // nothing to do
     }
 }
 
-auto MainWindow::handle_issue_list_reply(const std::string& s) -> void {
-    if (s == (issue_list_request + " FINISHED\n")) {
-        issue_list_request.clear();
-    } else if (s.starts_with(issue_list_request + " RESULT ") && s.ends_with("\n")) {
-        // + 8 for " RESULT ", -1 for "\n"
-        const auto tickets = std::string{s.c_str() + issue_list_request.size() + 8, s.c_str() + s.size() - 1};
-        std::istringstream ss {tickets};
-        std::vector<std::string> issues;
-        std::string tmp;
-        while (std::getline(ss, tmp, ',')) {
-            issues.emplace_back(std::move(tmp));
+auto MainWindow::handle_issue_list_reply(decoded_reply& reply) -> void {
+    const auto& msg = reply.msg;
+    if (msg.kind == reply_kind::finished) {
+        issue_list_request = {};
+    } else if (auto* issues = get_result<issue_list_result>(reply); issues != nullptr) {
+        if (!issues->has_value()) {
+            do_on_server_error(issues->error());
+            return;
         }
 
-        std::sort(issues.begin(), issues.end(), is_issue_before);
-
         ui->issues_list->clear();
-        for (const auto& issue : issues) {
-            ui->issues_list->addItem(QString::fromStdString(issue));
+        ui->issues_list->addItems(issues->value());
+        // the list might replace the one of the previous run, keep the selection
+        if (!selected_issue.empty()) {
+            if (const auto items = ui->issues_list->findItems(to_qstring(selected_issue), Qt::MatchExactly); !items.empty()) {
+                ui->issues_list->setCurrentItem(items.front());
+            }
         }
 
-        if ((!first_ticket_loaded) && (!issues.empty())) {
+        if ((!first_ticket_loaded) && (!issues->value().empty())) {
             set_tickets_finished_loaded_page(ui->html_page_widget);
             first_ticket_loaded = true;
         }
-    } else if (s == (issue_list_request + " ACK\n")) {
+    } else if (msg.kind == reply_kind::ack) {
         // nothing special to do
     }
 }
 
-auto MainWindow::handle_ticket_view_reply(const std::string& s) -> void {
-    if (s == (ticket_view_request + " FINISHED\n")) {
-        ticket_view_request.clear();
-    } else if (s.starts_with(ticket_view_request + " RESULT ")) {
-        // + 8 for RESULT., - 1 to remove the \n
-        const auto base64_view = std::string_view(s.c_str() + ticket_view_request.size() + 8, s.c_str() + s.size() - 1);
-        try {
-            const auto decoded = base64_decode(base64_view);
-            ui->html_page_widget->setContent(QByteArray::fromRawData(reinterpret_cast<const char *>(decoded.data()),
-                                                                     static_cast<qsizetype>(decoded.size())), "text/html;charset=UTF-8");
-        } catch (const std::exception& e) {
-            ui->html_page_widget->setHtml(QString("Failed to decode ").append(s.c_str()).append(" error is ").append(e.what()));
-        } catch (...) {
-            ui->html_page_widget->setHtml(QString("Failed to decode ").append(s.c_str()));
+auto MainWindow::handle_ticket_view_reply(decoded_reply& reply, bool is_conditional) -> void {
+    const auto& msg = reply.msg;
+    if (msg.kind == reply_kind::finished) {
+        ticket_view_request = {};
+    } else if (msg.kind == reply_kind::not_modified) {
+        // the page shown is the server's one, nothing to decode or paint
+        if (auto* page = find_cached<page_view>(view_cache, ticket_view_tab, ticket_view_issue); page != nullptr) {
+            page->generation = view_generation;
         }
-
-    } else if (s == (ticket_view_request + " ACK\n")) {
+    } else if (msg.kind == reply_kind::error) {
+        if (is_conditional) {
+            // Either the server doesn't know conditional fetches, or the ticket can't be fetched
+            // at all. A plain fetch tells which, whatever the server's error message says.
+            start_ticket_view_request(ticket_view_issue, false);
+            conditional_fallback_request_number = ticket_view_request.number;
+        } else {
+            ticket_view_request = {};
+            ticket_view_issue = {};
+            ui->html_page_widget->setHtml(QString("Failed to request the ticket from the server: ").append(to_qstring(msg.payload)));
+        }
+    } else if (const auto* page = get_result<ticket_page_result>(reply); page != nullptr) {
+        if (page->has_value()) {
+            if (ticket_view_request.number == conditional_fallback_request_number) {
+                // the page is transferred as a whole from now on
+                server_knows_conditional_fetch = false;
+            }
+            const auto& html = page->value().html;
+            ui->html_page_widget->setContent(html, "text/html;charset=UTF-8");
+            // pages from binary frames point into the reply, the cache needs its own copy
+            view_cache.insert(view_cache_key(ticket_view_tab, ticket_view_issue),
+                              cached_view<page_view>{
+                                  .view = { .html = QByteArray(html.constData(), html.size()), .content_hash = page->value().content_hash },
+                                  .generation = view_generation,
+                              },
+                              static_cast<size_t>(html.size()));
+        } else {
+            ui->html_page_widget->setHtml(QString("Failed to decode ").append(to_qstring(msg.payload)).append(" error is ").append(page->error().c_str()));
+        }
+    } else if (msg.kind == reply_kind::ack) {
         // nothing special to do
     }
 }
 
-auto MainWindow::handle_ticket_properties_reply(const std::string& s) -> void {
-    if (s == (ticket_properties_request + " FINISHED\n")) {
-        ticket_properties_request.clear();
-    } else if (s.starts_with(ticket_properties_request + " RESULT ")) {
-        // + 8 for " RESULT ", -1 for "\n"
-        const auto result_data = std::string{s.c_str() + ticket_properties_request.size() + 8, s.c_str() + s.size() - 1};
-        const auto pairs_vec = split_into_key_value_array(result_data);
-
-        struct kv_prop {
-            std::string key;
-            std::string value;
-            kv_prop(std::string k, std::string v) noexcept : key(std::move(k)), value(std::move(v)) {}
-        };
-
-        std::vector<kv_prop> table_data;
-        for (const auto& kv : pairs_vec) {
-            const auto& encoded_key = kv.key;
-            const auto& encoded_value = kv.value;
-            try {
-                const auto decoded_key_raw = base64_decode(std::string_view{encoded_key});
-                const auto decoded_value_raw = base64_decode(std::string_view{encoded_value});
-                auto decoded_key = std::string(decoded_key_raw.cbegin(), decoded_key_raw.cend());
-                auto decoded_value = std::string(decoded_value_raw.cbegin(), decoded_value_raw.cend());
-                table_data.emplace_back(std::move(decoded_key), std::move(decoded_value));
-            } catch (...) {
-                std::cout << std::format("Error with encoded key/value. Key={} Value={}\n", encoded_key, encoded_value);
-                table_data.emplace_back(std::format("Error with encoded key/value. Key={}", encoded_key),
-                                        std::format("Error with encoded key/value. value={}", encoded_value));
-            }
-        }
-
-        std::sort(table_data.begin(), table_data.end(), [](const auto& a, const auto& b){
-            return a.key < b.key;
-        });
-
-        auto& properties_widget = *ui->properties_widget;
-        properties_widget.clearContents();
-        const auto nr_rows = table_data.size();
-        properties_widget.setRowCount(static_cast<int>(nr_rows));
-
-        for (size_t i = 0; i < nr_rows; ++i) {
-            const auto& elt = table_data[i];
-            properties_widget.setItem(static_cast<int>(i), 0, new QTableWidgetItem(QString::fromStdString(elt.key)));
-            properties_widget.setItem(static_cast<int>(i), 1, new QTableWidgetItem(QString::fromStdString(elt.value)));
+auto MainWindow::handle_ticket_properties_reply(decoded_reply& reply) -> void {
+    const auto& msg = reply.msg;
+    if (msg.kind == reply_kind::finished) {
+        ticket_properties_request = {};
+    } else if (auto* table_data = get_result<properties_result>(reply); table_data != nullptr) {
+        if (!table_data->has_value()) {
+            auto& properties_widget = *ui->properties_widget;
+            properties_widget.clearContents();
+            properties_widget.setRowCount(1);
+            properties_widget.setItem(0, 0, new QTableWidgetItem(QString("Error with encoded key/value")));
+            properties_widget.setItem(0, 1, new QTableWidgetItem(QString::fromStdString(table_data->error())));
+            return;
         }
-
-    } else if (s == (ticket_properties_request + " ACK\n")) {
+        show_properties(*ui->properties_widget, table_data->value());
+        const auto nr_bytes = cached_size(table_data->value());
+        view_cache.insert(view_cache_key(properties_tab, ticket_properties_issue),
+                          cached_view<std::vector<property_row>>{ .view = std::move(table_data->value()), .generation = view_generation }, nr_bytes);
+    } else if (msg.kind == reply_kind::ack) {
         // nothing special to do
     }
 }
 
-auto MainWindow::handle_ticket_attachment_reply(const std::string& s) -> void {
-    if (s == (ticket_attachments_request + " FINISHED\n")) {
-        ticket_attachments_request.clear();
+auto MainWindow::handle_ticket_attachment_reply(decoded_reply& reply) -> void {
+    const auto& msg = reply.msg;
+    if (msg.kind == reply_kind::finished) {
+        ticket_attachments_request = {};
         if (nr_attachment_for_ticket == 0) {
-            ui->attachments_widget->setEnabled(false);
+            show_attachments(*ui->attachments_widget, {});
+            view_cache.insert(view_cache_key(attachments_tab, ticket_attachments_issue),
+                              cached_view<std::vector<attachment_row>>{ .view = {}, .generation = view_generation }, 0);
+        }
+    } else if ((msg.kind == reply_kind::result) && (!msg.payload.empty())) {
+        auto* table_data = get_result<attachments_result>(reply);
+        if (table_data == nullptr) {
+            return;
+        }
+        if (!table_data->has_value()) {
             ui->attachments_widget->clear();
-            ui->attachments_widget->addItem(QString("This ticket has no attachment"));
-        }
-    } else if (s.starts_with(ticket_attachments_request + " RESULT ")) {
-        // interesting data here
-        const auto result_data = std::string{s.c_str() + ticket_attachments_request.size() + 8, s.c_str() + s.size() - 1};
-        auto pair_vec = split_into_key_value_array(result_data);
-
-        struct uuid_fname {
-            std::string uuid;
-            std::string filename;
-            uuid_fname(std::string u, std::string f) noexcept
-            : uuid(std::move(u))
-            , filename(std::move(f))
-            {
-            }
-        };
-
-        std::vector<uuid_fname> table_data;
-        for (auto& uf : pair_vec) {
-            auto& uuid = uf.key;
-            const auto& encoded_filename = uf.value;
-            try {
-                const auto decoded_fname_raw = base64_decode(std::string_view{encoded_filename});
-                auto decoded_fname = std::string(decoded_fname_raw.cbegin(), decoded_fname_raw.cend());
-                table_data.emplace_back(std::move(uuid), std::move(decoded_fname));
-            } catch (...) {
-                std::cout << std::format("Error with encoded filename. uuid={} encoded_value={}\n", uuid, encoded_filename);
-                table_data.emplace_back(std::format("Error with uuid/encoded name. uuid={}", uuid),
-                                        std::format("Error with uuid/encoded name. encoded name={}", encoded_filename));
-            }
+            ui->attachments_widget->addItem(QString("Failed to decode the attachment list: ").append(table_data->error().c_str()));
+            return;
         }
 
-        std::sort(table_data.begin(), table_data.end(), [](const auto& a, const auto& b){
-            return a.filename < b.filename;
-        });
-
-        ui->attachments_widget->clear();
-        ui->attachments_widget->setEnabled(true);
-        for (auto& uuid_fname : table_data) {
-            ui->attachments_widget->addItem(new AttachmentItem(std::move(uuid_fname.uuid), std::move(uuid_fname.filename)));
-        }
-        nr_attachment_for_ticket = table_data.size();
-    } else if (s.starts_with(ticket_attachments_request + " RESULT\n")) {
+        show_attachments(*ui->attachments_widget, table_data->value());
+        nr_attachment_for_ticket = table_data->value().size();
+        const auto nr_bytes = cached_size(table_data->value());
+        view_cache.insert(view_cache_key(attachments_tab, ticket_attachments_issue),
+                          cached_view<std::vector<attachment_row>>{ .view = std::move(table_data->value()), .generation = view_generation }, nr_bytes);
+    } else if (msg.kind == reply_kind::result) {
         if (nr_attachment_for_ticket == 0) {
             ui->attachments_widget->setEnabled(false);
             ui->attachments_widget->clear();
             ui->attachments_widget->addItem(QString("This ticket has no attachment in the local database. Let's see if some were attached remotely"));
         }
-    } else if (s == (ticket_attachments_request + " ACK\n")) {
+    } else if (msg.kind == reply_kind::ack) {
             // nothing special to do
     }
 }
 
-auto MainWindow::handle_download_msg_reply(const std::string& msg, std::vector<MainWindow::fname_req>::iterator file_to_dl) -> void {
-    const auto &req = file_to_dl->request;
-    if (msg.starts_with(std::format("{} RESULT ", req))) {
-        // 8 for " RESULT ", -1 for '\n'
-        const auto result_data = std::string_view(msg.c_str() + req.size() + 8, msg.c_str() + msg.size() - 1);
-        try {
-            const auto decoded = base64_decode(result_data);
-            std::ofstream out_file(file_to_dl->filename, std::ios::out | std::ios::trunc | std::ios::binary);
-            out_file.write(reinterpret_cast<const char *>(decoded.data()), static_cast<long>(decoded.size()));
-            out_file.close();
-        } catch (const std::exception &e) {
-            do_on_server_error(std::format("failed to save file {}. Err={}", file_to_dl->filename, e.what()));
-        } catch (...) {
-            do_on_server_error(
-                    std::format("failed to run base64 decode on data for file {}", file_to_dl->filename));
-        }
-    } else if (msg.starts_with(std::format("{} RESULT\n", req))) {
-        // empty file
-        std::ofstream out_file(file_to_dl->filename, std::ios::out | std::ios::trunc | std::ios::binary);
-        out_file.close();
-    } else if (msg.starts_with(std::format("{} ERROR ", req))) {
-        const auto result_data = std::string_view(msg.c_str() + req.size() + 7, msg.c_str() + msg.size() - 1);
-        do_on_server_error(std::format("Error when dl file {}: {}", file_to_dl->filename, result_data));
-    } else if (msg.starts_with(std::format("{} FINISHED", req))) {
-        std::swap(*std::prev(files_to_download.end()), *file_to_dl);
-        files_to_download.erase(std::prev(files_to_download.end()), files_to_download.end());
-    }
-
-}
-
-auto MainWindow::find_elt_to_dl_for_msg(const std::string& msg) -> std::vector<MainWindow::fname_req>::iterator {
-    auto file_to_dl = std::find_if(files_to_download.begin(), files_to_download.end(), [&](const auto &item) {
-        if (!msg.starts_with(item.request)) {
-            return false;
-        }
-        // check again with a space to ensure no "prefix" issue
-        const auto req_with_space = std::format("{} ", item.request);
-        const auto res = msg.starts_with(req_with_space);
-        return res;
-    });
-    return file_to_dl;
+auto MainWindow::handle_prefetch_reply(decoded_reply& reply, const std::string& cache_key, std::uint64_t request_number) -> void {
+    const auto it = prefetch_requests.find(cache_key);
+    if ((it == prefetch_requests.end()) || (it->second.number != request_number)) {
+        return;
+    }
+    const auto& msg = reply.msg;
+    if ((msg.kind == reply_kind::finished) || (msg.kind == reply_kind::error)) {
+        prefetch_requests.erase(it);
+    } else if (const auto* page = get_result<ticket_page_result>(reply); (page != nullptr) && page->has_value()) {
+        // pages from binary frames point into the reply, the cache needs its own copy
+        const auto& html = page->value().html;
+        const auto nr_bytes = static_cast<size_t>(html.size());
+        prefetch_cache.insert(cache_key,
+                              prefetched_view{
+                                  .view = cached_view<page_view>{
+                                      .view = { .html = QByteArray(html.constData(), html.size()), .content_hash = page->value().content_hash },
+                                      .generation = view_generation,
+                                  },
+                                  .nr_bytes = nr_bytes,
+                              },
+                              nr_bytes);
+    } else if (auto* rows = get_result<properties_result>(reply); (rows != nullptr) && rows->has_value()) {
+        const auto nr_bytes = cached_size(rows->value());
+        prefetch_cache.insert(cache_key,
+                              prefetched_view{
+                                  .view = cached_view<std::vector<property_row>>{ .view = std::move(rows->value()), .generation = view_generation },
+                                  .nr_bytes = nr_bytes,
+                              },
+                              nr_bytes);
+    }
+    // a view failing to decode isn't cached, it gets requested again if the user selects it
+}
+
+auto MainWindow::handle_download_msg_reply(decoded_reply& reply, const std::string& filename) -> void {
+    const auto& msg = reply.msg;
+    if (const auto* saved = get_result<download_result>(reply); saved != nullptr) {
+        // the file was saved by the decode worker
+        if (!saved->has_value()) {
+            do_on_server_error(std::format("failed to save file {}. Err={}", filename, saved->error()));
+        }
+    } else if (msg.kind == reply_kind::error) {
+        do_on_server_error(std::format("Error when dl file {}: {}", filename, msg.payload.as_string_view()));
+    }
+}
+
+auto MainWindow::do_on_server_replies(std::vector<decoded_reply> replies) -> void {
+    // widgets updated by several replies of the batch are repainted only once, at the end
+    setUpdatesEnabled(false);
+    for (auto& reply : replies) {
+        // replies to requests nobody waits for anymore are dropped
+        router.dispatch(reply);
+    }
+    setUpdatesEnabled(true);
+}
+
+auto MainWindow::next_request_number() -> std::uint64_t {
+    return nr_request++;
+}
+
+void MainWindow::send_request(std::uint64_t request_number, std::string request,
+                              request_router::reply_handler on_reply, request_router::failure_handler on_failure,
+                              request_priority priority, reply_decoder decoder) {
+    router.add(request_number, std::move(on_reply), std::move(on_failure));
+    if (decoder) {
+        decoders.expect(request_number, std::move(decoder));
+    }
+
+    auto request_id = std::string(protocol::get_request_id(request));
+    // queuing never blocks the UI thread. It fails straight away if the server can't keep up
+    if (auto queued = server_handler.queue_request(std::move(request_id), std::move(request), priority); !queued.has_value()) {
+        decoders.forget(request_number);
+        router.fail(request_number, queued.error());
+    }
 }
 
+void MainWindow::replace_view_request(view_request& current, std::uint64_t request_number, std::string_view request_id) {
+    cancel_view_request(current);
+    current = view_request{.number = request_number, .id = std::string(request_id)};
+}
 
-auto MainWindow::do_on_server_reply(std::string s) -> void {
-    if (s.starts_with(issue_list_request + " ")) {
-        handle_issue_list_reply(s);
-    } else if (s.starts_with(ticket_view_request + " ")) {
-        handle_ticket_view_reply(s);
-    } else if (s.starts_with(ticket_properties_request + " ")) {
-        handle_ticket_properties_reply(s);
-    } else if (s.starts_with(ticket_attachments_request + " ")) {
-        handle_ticket_attachment_reply(s);
-    } else if (s.starts_with(synchronise_projects_request + " ")) {
-        handle_synchronise_projects_reply(s);
-    } else if (s.starts_with(full_reset_request + " ")) {
-        handle_full_reset_reply(s);
-    } else if (auto it = find_elt_to_dl_for_msg(s);
-               it != files_to_download.end()) {
-        handle_download_msg_reply(s, it);
+void MainWindow::cancel_view_request(view_request& current) {
+    if (current.number == 0) {
+        return;
+    }
+    // nobody will look at the result anymore. Its replies are dropped without being decoded, and
+    // the server is told to stop working on it, unless it didn't even get it yet.
+    router.forget(current.number);
+    decoders.forget(current.number);
+    if (auto cancelled = server_handler.cancel_request(current.id); !cancelled.has_value()) {
+        std::cout << std::format("Failed to cancel request {}: {}\n", current.id, cancelled.error());
+    }
+    current = {};
+}
+
+auto MainWindow::do_on_request_failed(std::string request_id, std::string reason) -> void {
+    // The writer only gives up when the server can't be written to anymore, and then fails every
+    // pending request at once. Their handlers clean up after them, the user is told once.
+    const auto is_first_failure = !server_stopped_taking_requests;
+    server_stopped_taking_requests = true;
+    if (const auto request_number = parse_request_number(request_id); request_number.has_value()) {
+        decoders.forget(request_number.value());
+        router.fail(request_number.value(), reason);
+    }
+    if (is_first_failure) {
+        QMessageBox::warning(this, QString("Error from server"), QString::fromStdString(std::format("The server doesn't take requests anymore: {}", reason)));
     }
 }
 
 auto MainWindow::do_on_server_error(std::string s) -> void {
+    if (server_stopped_taking_requests) {
+        std::cout << std::format("Error: {}\n", s);
+        return;
+    }
     // todo, display a nice error window, propose to restart the background server instead of the app ...
     // or automatically restart the background server and only notify the user if it crashes more than
     // X times in Y seconds.
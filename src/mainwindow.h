@@ -3,8 +3,18 @@
 
 #include "qtreewidget.h"
 #include <QMainWindow>
+#include <QTimer>
 #include "ui_mainwindow.h"
+#include <any>
+#include <optional>
+#include <unordered_map>
+
+#include "decode_pipeline.hh"
+#include "lru_cache.hh"
+#include "render_cache.hh"
 #include "prog_handler.hh"
+#include "request_router.hh"
+#include "string_table.hh"
 
 QT_BEGIN_NAMESPACE
 namespace Ui {
@@ -12,69 +22,141 @@ class MainWindow;
 }
 QT_END_NAMESPACE
 
+struct prefetch_stats {
+    std::uint64_t nr_requested; // views requested before the user asked for them
+    std::uint64_t nr_served;    // prefetched views the user then looked at
+    lru_cache_stats cache;      // prefetched views not looked at yet
+};
+
 class MainWindow final : public QMainWindow
 {
     Q_OBJECT
 
 public:
-    MainWindow(ProgHandler& server_handler, QWidget *parent = nullptr);
+    // view_cache_budget bounds the memory used to keep the views of recently viewed tickets,
+    // prefetch_budget the one of the views of the tickets around the selected one. 0 disables
+    // prefetching. What previous_runs_cache holds is shown until the server answers. It may be nullptr.
+    MainWindow(ProgHandler& server_handler, decode_pipeline& reply_decoders, string_table& strings, size_t view_cache_budget,
+               size_t prefetch_budget, render_cache* previous_runs_cache, QWidget *parent = nullptr);
     MainWindow(const MainWindow&) = delete;
     MainWindow& operator=(const MainWindow&) = delete;
-    ~MainWindow() override = default;
+    // remembers the selected ticket for the next run
+    ~MainWindow() override;
+
+    auto view_cache_stats() const noexcept -> lru_cache_stats { return view_cache.stats(); }
+    auto prefetcher_stats() const noexcept -> prefetch_stats;
 
 private slots:
     auto jira_issue_activated(QListWidgetItem* selected) -> void;
     auto download_file_activated(QListWidgetItem* selected) -> void;
     auto do_on_synchronise_projects_clicked() -> void;
     auto do_on_full_projects_reset_clicked() -> void;
+    auto do_on_tab_changed(int index) -> void;
+    auto do_on_prefetch_timeout() -> void;
 
 public slots:
     // don't call these on_* otherwise Qt tries to do some automatic
     // connect signal to slot and warns about non-existing signals
     // for these slots
-    auto do_on_server_reply(std::string s) -> void;
+    auto do_on_server_replies(std::vector<decoded_reply> replies) -> void;
     auto do_on_server_error(std::string s) -> void;
+    auto do_on_request_failed(std::string request_id, std::string reason) -> void;
 
 private:
-    struct fname_req {
-        fname_req(std::string f, std::string r) noexcept
-                : filename(std::move(f))
-                , request(std::move(r))
-        {}
-        std::string filename;
-        std::string request;
+    struct view_request {
+        std::uint64_t number = 0; // 0 when no request is in flight
+        std::string id = {};
     };
 
-private:
+    // paints the issue list and the last viewed ticket of the previous run, from the render cache
+    void show_previous_run();
     void refresh_ticket(const std::string& issue_name);
+    // requests the content of the visible tab, unless it already shows the selected issue
+    void load_current_tab();
+    // after a synchronisation, any ticket might have changed
+    void invalidate_ticket_views();
     void start_ticket_attachment_request(const std::string& issue_name);
     void start_ticket_properties_request(const std::string& issue_name);
-    void start_ticket_view_request(const std::string& issue_name);
+    // with known_hash, the server only sends the page if its content has another hash
+    void start_ticket_view_request(const std::string& issue_name, bool show_loading_page = true,
+                                   std::optional<std::uint64_t> known_hash = std::nullopt);
     void start_issue_list_request();
 
-    auto handle_synchronise_projects_reply(const std::string& s) -> void;
-    auto handle_full_reset_reply(const std::string& s) -> void;
-    auto handle_issue_list_reply(const std::string& s) -> void;
-    auto handle_ticket_view_reply(const std::string& s) -> void;
-    auto handle_ticket_properties_reply(const std::string& s) -> void;
-    auto handle_ticket_attachment_reply(const std::string& s) -> void;
-    auto handle_download_msg_reply(const std::string& msg, std::vector<fname_req>::iterator file_to_dl) -> void;
+    // prefetching starts once the user stayed on a ticket for a little while
+    void schedule_prefetch();
+    // requests the views of the tickets around the selected one which aren't cached yet, and
+    // cancels the prefetches of the other tickets
+    void prefetch_neighbours();
+    void start_prefetch_request(int tab, const std::string& issue_name);
+    void cancel_prefetch_requests();
+    // moves the prefetched view, if any, to view_cache
+    void adopt_prefetched_view(int tab, const std::string& issue_name);
+
+    static auto next_request_number() -> std::uint64_t;
+    // registers the handlers for the request, then sends it to the server. request is encoded
+    // with the protocol schema, using request_number in its id. When given, the decoder prepares
+    // RESULT replies on a worker thread before they reach on_reply.
+    void send_request(std::uint64_t request_number, std::string request,
+                      request_router::reply_handler on_reply, request_router::failure_handler on_failure,
+                      request_priority priority = request_priority::interactive, reply_decoder decoder = {});
 
-    auto find_elt_to_dl_for_msg(const std::string& msg) -> std::vector<MainWindow::fname_req>::iterator;
+    // the request previously in current, if any, is cancelled
+    void replace_view_request(view_request& current, std::uint64_t request_number, std::string_view request_id);
+    void cancel_view_request(view_request& current);
+
+    auto handle_synchronise_projects_reply(const server_message& msg) -> void;
+    auto handle_full_reset_reply(const server_message& msg) -> void;
+    auto handle_issue_list_reply(decoded_reply& reply) -> void;
+    auto handle_ticket_view_reply(decoded_reply& reply, bool is_conditional) -> void;
+    auto handle_ticket_properties_reply(decoded_reply& reply) -> void;
+    auto handle_ticket_attachment_reply(decoded_reply& reply) -> void;
+    auto handle_prefetch_reply(decoded_reply& reply, const std::string& cache_key, std::uint64_t request_number) -> void;
+    auto handle_download_msg_reply(decoded_reply& reply, const std::string& filename) -> void;
 
 
 private:
     std::unique_ptr<Ui::MainWindow> ui;
     ProgHandler& server_handler;
+    decode_pipeline& decoders;
+    // used by the decode workers, it outlives them
+    string_table& shared_strings;
+    // used by the decode workers too, it outlives them. nullptr when there is none
+    render_cache* disk_cache;
     // todo: really move the communication protocol out of the gui
-    std::string issue_list_request = {};
-    std::string ticket_view_request = {} ;
-    std::string ticket_properties_request = {};
-    std::string ticket_attachments_request = {};
-    std::string synchronise_projects_request = {};
-    std::string full_reset_request = {};
+    request_router router = {};
+    // latest request for each view. Replies to older requests are ignored
+    view_request issue_list_request = {};
+    view_request ticket_view_request = {};
+    view_request ticket_properties_request = {};
+    view_request ticket_attachments_request = {};
+    // tabs are only loaded once shown. Each one remembers the issue it shows, or is loading,
+    // so that switching back and forth doesn't request it again. Empty when it must be loaded.
+    std::string selected_issue = {};
+    std::string ticket_view_issue = {};
+    std::string ticket_properties_issue = {};
+    std::string ticket_attachments_issue = {};
+    // decoded views of the recently viewed tickets, so that going back to one needs no request
+    lru_cache<std::any> view_cache;
+    // incremented by each synchronisation. Cached views fetched before the latest one are stale
+    std::uint64_t view_generation = 1;
+    bool server_knows_conditional_fetch = true;
+    // plain fetch sent after a conditional one failed. If it succeeds, the server doesn't know conditional fetches
+    std::uint64_t conditional_fallback_request_number = 0;
+    // views of the tickets around the selected one, requested at background priority while the
+    // user reads it. Kept apart from view_cache, so that they never evict what the user looked at
+    struct prefetched_view {
+        std::any view; // same types as in view_cache
+        size_t nr_bytes;
+    };
+    lru_cache<prefetched_view> prefetch_cache;
+    bool prefetch_enabled;
+    QTimer prefetch_timer;
+    // in flight, by view cache key
+    std::unordered_map<std::string, view_request> prefetch_requests = {};
+    std::uint64_t nr_prefetch_requested = 0;
     size_t nr_attachment_for_ticket = 0;
     bool first_ticket_loaded = false;
-    std::vector<fname_req> files_to_download = {};
+    // the request writer gave up, the user was told and further errors are only logged
+    bool server_stopped_taking_requests = false;
 };
 #endif // MAINWINDOW_H
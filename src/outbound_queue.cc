@@ -0,0 +1,71 @@
+#include <algorithm>
+#include <format>
+#include <utility>
+
+#include "outbound_queue.hh"
+
+outbound_queue::outbound_queue(size_t max_nr_bytes) noexcept
+    : max_nr_pending_bytes(max_nr_bytes)
+    , wake_up()
+{
+}
+
+auto outbound_queue::push(outbound_request request) -> std::expected<void, std::string> {
+    {
+        const std::lock_guard lock(mutex);
+        if (is_closed) {
+            return std::unexpected(close_reason);
+        }
+        // backpressure: the caller learns straight away that the server can't keep up,
+        // instead of being blocked until there is room in the pipe.
+        const auto request_size = request.data.size();
+        if (nr_pending_bytes + request_size > max_nr_pending_bytes) {
+            return std::unexpected(std::format("too many requests waiting to be sent to the server ({} bytes pending)", nr_pending_bytes));
+        }
+        nr_pending_bytes += request_size;
+        queued.emplace_back(std::move(request));
+    }
+    wake_up.signal();
+    return {};
+}
+
+auto outbound_queue::cancel(std::string_view request_id) -> bool {
+    const std::lock_guard lock(mutex);
+    // the consumer may have taken the hint, or the request, already
+    cancelled.emplace_back(request_id);
+    bool is_removed = false;
+    std::erase_if(queued, [&](const outbound_request& request) noexcept {
+        const auto is_request = request.request_id == request_id;
+        if (is_request || (request.hint_for == request_id)) {
+            nr_pending_bytes -= std::min(request.data.size(), nr_pending_bytes);
+            is_removed = is_removed || is_request;
+            return true;
+        }
+        return false;
+    });
+    return is_removed;
+}
+
+auto outbound_queue::take_cancelled() -> std::vector<std::string> {
+    const std::lock_guard lock(mutex);
+    return std::exchange(cancelled, {});
+}
+
+void outbound_queue::pop_all(std::deque<outbound_request>& dest) {
+    const std::lock_guard lock(mutex);
+    for (auto& request : queued) {
+        dest.emplace_back(std::move(request));
+    }
+    queued.clear();
+}
+
+void outbound_queue::release(size_t nr_bytes) noexcept {
+    const std::lock_guard lock(mutex);
+    nr_pending_bytes -= std::min(nr_bytes, nr_pending_bytes);
+}
+
+void outbound_queue::close(std::string reason) {
+    const std::lock_guard lock(mutex);
+    is_closed = true;
+    close_reason = std::move(reason);
+}
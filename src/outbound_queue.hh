@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <expected>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "request_priority.hh"
+#include "wake_up_event.hh"
+
+struct outbound_request {
+    std::string request_id; // used to report failures back to whoever queued the request
+    std::string data; // encoded request, including the trailing '\n'
+    request_priority priority = request_priority::interactive;
+    std::string hint_for = {}; // for priority hints, the id of the request they are about
+    bool report_failure = true; // false for priority hints and cancels, nobody waits for their replies
+};
+
+// Multiple producers, single consumer queue of requests to send to the server.
+// Producers (typically the UI thread) never block: pushing either succeeds immediately
+// or fails when too many bytes are waiting to be written, or when the consumer gave up.
+// The consumer is the writer thread, which sleeps on the wake up fd until requests arrive.
+class outbound_queue final {
+public:
+    explicit outbound_queue(size_t max_nr_pending_bytes = size_t{1024} * 1024) noexcept;
+
+    outbound_queue(const outbound_queue&) = delete;
+    outbound_queue& operator=(const outbound_queue&) = delete;
+
+    auto push(outbound_request request) -> std::expected<void, std::string>;
+
+    // Removes the request and its priority hint if they are still waiting in the queue.
+    // Returns false if the request isn't in the queue, e.g. because the consumer already took
+    // it. The consumer learns about the cancellation with take_cancelled either way.
+    auto cancel(std::string_view request_id) -> bool;
+    // ids of the requests cancelled since the last call. The consumer must drop these requests
+    // and their hints if it didn't write them yet.
+    auto take_cancelled() -> std::vector<std::string>;
+
+    // moves all queued requests at the end of dest. Their bytes still count as pending
+    // until the consumer calls release.
+    void pop_all(std::deque<outbound_request>& dest);
+    // gives back nr_bytes of budget once they were written (or dropped) by the consumer
+    void release(size_t nr_bytes) noexcept;
+
+    // further pushes fail with the given reason
+    void close(std::string reason);
+
+    // becomes readable when requests were pushed since the last call to clear_wake_up.
+    auto get_wake_up_fd() const noexcept -> int { return wake_up.get_fd(); }
+    void clear_wake_up() const noexcept { wake_up.clear(); }
+    auto is_valid() const noexcept -> bool { return wake_up.is_valid(); }
+
+private:
+    mutable std::mutex mutex = {};
+    std::vector<outbound_request> queued = {};
+    std::vector<std::string> cancelled = {};
+    size_t nr_pending_bytes = 0;
+    const size_t max_nr_pending_bytes;
+    std::string close_reason = {};
+    bool is_closed = false;
+    wake_up_event wake_up;
+};
@@ -1,9 +1,16 @@
 #include <iostream>
 
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
 #include "prog_handler.hh"
 
-ProgHandler::ProgHandler(ProgHandler&& other) noexcept {
-    child = other.child;
+ProgHandler::ProgHandler(ProgHandler&& other) noexcept
+    : child(other.child)
+    , requests_queue(std::move(other.requests_queue))
+    , bulk(std::move(other.bulk))
+    , session_recording(std::move(other.session_recording))
+{
     other.child = std::nullopt;
 }
 
@@ -27,10 +34,13 @@ ProgHandler& ProgHandler::operator=(ProgHandler&& other) noexcept {
 
     child = other.child;
     other.child = std::nullopt;
+    requests_queue = std::move(other.requests_queue);
+    bulk = std::move(other.bulk);
+    session_recording = std::move(other.session_recording);
     return *this;
 }
 
-auto ProgHandler::try_new(const char* const prog_exec) noexcept -> std::expected<ProgHandler, std::string> {
+auto ProgHandler::try_new(const char* const prog_exec, std::span<const char* const> prog_args) noexcept -> std::expected<ProgHandler, std::string> {
 
     std::array<int, 2> child_out;
     std::array<int, 2> child_in;
@@ -95,14 +105,32 @@ auto ProgHandler::try_new(const char* const prog_exec) noexcept -> std::expected
     }
 
 
-    const std::array<char*, 1> child_argv = { nullptr };
+    // big payloads go through shared memory when the server supports it. Not having it only
+    // means everything goes through the pipe.
+    auto bulk_data_channel = bulk_channel::try_new();
+    if (!bulk_data_channel.has_value()) {
+        std::cout << std::format("Failed to create the bulk channel: {}\n", bulk_data_channel.error());
+    } else if (const auto ret = posix_spawn_file_actions_adddup2(&file_actions, bulk_data_channel.value()->get_fd(), bulk_channel::server_fd); ret != 0) {
+        // dup2 also clears close-on-exec, even when the memfd already is server_fd
+        std::cout << std::format("Failed to give the bulk channel to the server: {}\n", strerror(ret));
+        bulk_data_channel = std::unexpected(std::string("not inherited by the server"));
+    }
+
+    // posix_spawn takes non const strings for historical reasons, it doesn't modify them
+    std::vector<char*> child_argv;
+    child_argv.reserve(prog_args.size() + 2);
+    child_argv.push_back(const_cast<char*>(prog_exec));
+    for (const auto* const arg : prog_args) {
+        child_argv.push_back(const_cast<char*>(arg));
+    }
+    child_argv.push_back(nullptr);
     const std::array<char*, 1> child_env = { nullptr };
 
     const auto spawn_ret = posix_spawn(&child_pid,
                                        prog_exec,
                                        &file_actions,
                                        nullptr,
-                                       &child_argv[0],
+                                       child_argv.data(),
                                        &child_env[0]);
     if (spawn_ret != 0) {
         auto ret_err = close_ressources_and_get_err("posix_spawn", spawn_ret);
@@ -111,11 +139,20 @@ auto ProgHandler::try_new(const char* const prog_exec) noexcept -> std::expected
 
     const auto child_out_fd = child_out[0];
 
+    // only our ends are non blocking. Waiting on them is done with poll, which, unlike a blocking
+    // read or write, can also be woken up on stop requests or give up after a timeout.
+    for (const auto fd : { child_in[1], child_out[0] }) {
+        if (const auto flags = fcntl(fd, F_GETFL); (flags == -1) || (fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)) {
+            std::cout << std::format("Failed to set pipe to non-blocking mode. Err is {}\n", strerror(errno));
+        }
+    }
+
     posix_spawn_file_actions_destroy(&file_actions);
     close(child_in[0]);
     close(child_out[1]);
 
-    auto res = ProgHandler(child_data_t{.pid = child_pid, .stdin_fd = child_in[1], .stdout_fd = child_out_fd});
+    auto res = ProgHandler(child_data_t{.pid = child_pid, .stdin_fd = child_in[1], .stdout_fd = child_out_fd},
+                           bulk_data_channel.value_or(nullptr));
     return res;
 }
 
@@ -128,59 +165,249 @@ auto ProgHandler::send_to_child(const std::string& msg, std::chrono::millisecond
         return false;
     }
 
-    constexpr const auto max_sleep_at_a_time = std::chrono::milliseconds(5);
-    std::chrono::milliseconds total_slept {0};
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
 
     const auto& child_data = child.value();
     const auto child_in_fd = child_data.stdin_fd;
     auto* msg_ptr = msg.data();
-    const auto nr_bytes = msg.size();
+    auto nr_bytes_left_to_write = msg.size();
 
-    auto nr_bytes_left_to_write = nr_bytes;
     while (nr_bytes_left_to_write > 0) {
-        errno = 0;
-        ssize_t write_ret;
-        do {
-            write_ret = write(child_in_fd, msg_ptr, nr_bytes_left_to_write);
-            if (write_ret > 0) {
-                nr_bytes_left_to_write -= static_cast<size_t>(write_ret);
-                msg_ptr += write_ret;
-            } else if (write_ret == 0) {
-                if (total_slept >= timeout) {
-                    return false;
-                } else {
-                    const auto time_to_sleep = std::min(max_sleep_at_a_time, timeout - total_slept);
-                    std::this_thread::sleep_for(std::chrono::milliseconds(time_to_sleep));
-                    total_slept += time_to_sleep;
-                }
-            }
-        } while ((write_ret >= 0) && (write_ret < static_cast<ssize_t>(nr_bytes_left_to_write)));
+        const auto write_ret = write(child_in_fd, msg_ptr, nr_bytes_left_to_write);
+        if (write_ret > 0) {
+            nr_bytes_left_to_write -= static_cast<size_t>(write_ret);
+            msg_ptr += write_ret;
+            continue;
+        }
 
-        if ((write_ret == static_cast<decltype(write_ret)>(-1))
-             && (errno != EAGAIN)
-             && (errno != EWOULDBLOCK)
-             && (errno != EINTR)) {
+        if ((write_ret == -1) && (errno != EINTR) && (!is_would_block(errno))) {
             std::cout << std::format("Write to child failed with error {}: {}\n", errno, strerror(errno));
             return false;
         }
 
-        if (total_slept >= timeout) {
+        // the pipe is full. Sleep until the child reads from it, or give up at the deadline
+        const auto time_left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        if (time_left <= std::chrono::milliseconds{0}) {
             return false;
-        } else {
-            const auto time_to_sleep = std::min(max_sleep_at_a_time, timeout - total_slept);
-            std::this_thread::sleep_for(std::chrono::milliseconds(time_to_sleep));
-            total_slept += time_to_sleep;
+        }
+        switch (wait_for_fd(child_in_fd, POLLOUT, -1, time_left)) {
+            case wait_result::ready:
+            case wait_result::woken_up:
+                break;
+            case wait_result::timed_out:
+                return false;
+            case wait_result::failed:
+                std::cout << std::format("Waiting to write to child failed with error {}: {}\n", errno, strerror(errno));
+                return false;
         }
     }
 
     return true;
 }
 
+auto ProgHandler::queue_request(std::string request_id, std::string request, request_priority priority) -> std::expected<void, std::string> {
+    if ((!child.has_value()) || (requests_queue == nullptr)) {
+        return std::unexpected(std::string("the server isn't running"));
+    }
+    if (priority != request_priority::interactive) {
+        // same priority as the request, so that the writer keeps it right before it
+        auto hint = protocol::make_request({priority_hint_request_id}, protocol::set_request_priority{request_id, priority});
+        if (auto queued = requests_queue->push(outbound_request{.request_id = std::string(priority_hint_request_id), .data = std::move(hint), .priority = priority, .hint_for = request_id, .report_failure = false});
+            !queued.has_value()) {
+            return queued;
+        }
+    }
+    return requests_queue->push(outbound_request{.request_id = std::move(request_id), .data = std::move(request), .priority = priority});
+}
+
+auto ProgHandler::cancel_request(std::string_view request_id) -> std::expected<void, std::string> {
+    if ((!child.has_value()) || (requests_queue == nullptr)) {
+        return std::unexpected(std::string("the server isn't running"));
+    }
+    if (requests_queue->cancel(request_id)) {
+        return {};
+    }
+    // replies to the cancel request carry the number of the cancelled request, so they are dropped along with its own replies
+    const auto cancel_request_id = std::format("cancel-{}", request_id);
+    return requests_queue->push(outbound_request{.request_id = cancel_request_id, .data = protocol::make_request({cancel_request_id}, protocol::cancel{request_id}), .report_failure = false});
+}
+
+void ProgHandler::record_session(std::shared_ptr<session_recorder> recorder) noexcept {
+    session_recording = std::move(recorder);
+}
+
+auto ProgHandler::write_requests_to_child(std::stop_token stop_token, int child_stdin_fd, outbound_queue& queue, session_recorder* recorder, const send_failure_fn& on_send_failed_fn) -> void {
+    const wake_up_event stop_event;
+    const std::stop_callback wake_up_on_stop(stop_token, [&stop_event]() { stop_event.signal(); });
+
+    std::deque<outbound_request> pending;
+    size_t nr_bytes_written_of_first = 0; // the first pending request might have been partially written
+
+    // once writing failed, nothing else can be sent. Report every request we know of, and
+    // make sure the ones queued later are refused right away.
+    const auto fail_all = [&](std::string reason) {
+        queue.close(reason);
+        queue.pop_all(pending);
+        for (auto& request : pending) {
+            if (request.report_failure) {
+                on_send_failed_fn(std::move(request.request_id), reason);
+            }
+        }
+        pending.clear();
+    };
+
+    if (!stop_event.is_valid()) {
+        fail_all(std::format("failed to create an eventfd. Err is {}: {}", errno, strerror(errno)));
+        return;
+    }
+
+    // writev takes at most IOV_MAX buffers. There is no point in batching more than that anyway.
+    constexpr size_t max_nr_requests_per_write = 64;
+    std::vector<iovec> buffers;
+    buffers.reserve(max_nr_requests_per_write);
+
+    while (!stop_token.stop_requested()) {
+        // clear before popping, so that a push happening in between isn't missed
+        queue.clear_wake_up();
+        const auto nr_pending_before = pending.size();
+        queue.pop_all(pending);
+        if (pending.size() != nr_pending_before) {
+            // requests waiting because the pipe was full are overtaken by newer ones with a higher priority.
+            // The first one can't be moved if it was partially written. Stable, so that requests of the
+            // same priority keep their order.
+            const auto first_movable = pending.begin() + ((nr_bytes_written_of_first > 0) ? 1 : 0);
+            std::stable_sort(first_movable, pending.end(), [](const outbound_request& a, const outbound_request& b) {
+                return a.priority < b.priority;
+            });
+        }
+        // Requests cancelled after they were taken from the queue. Those not written yet are dropped,
+        // so their CANCEL, which may have overtaken them, never refers to a request sent after it.
+        if (const auto cancelled = queue.take_cancelled(); !cancelled.empty()) {
+            const auto is_cancelled = [&](const outbound_request& request) noexcept {
+                return std::ranges::any_of(cancelled, [&](const std::string& id) noexcept {
+                    return (request.request_id == id) || (request.hint_for == id);
+                });
+            };
+            auto it = pending.begin() + ((nr_bytes_written_of_first > 0) ? 1 : 0);
+            while (it != pending.end()) {
+                if (is_cancelled(*it)) {
+                    queue.release(it->data.size());
+                    it = pending.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+
+        if (pending.empty()) {
+            if (wait_for_fd(queue.get_wake_up_fd(), POLLIN, stop_event.get_fd(), std::nullopt) == wait_result::failed) {
+                fail_all(std::format("failed to wait for requests. Err is {}: {}", errno, strerror(errno)));
+                return;
+            }
+            continue;
+        }
+
+        buffers.clear();
+        for (auto& request : pending) {
+            if (buffers.size() == max_nr_requests_per_write) {
+                break;
+            }
+            const auto offset = buffers.empty() ? nr_bytes_written_of_first : 0;
+            buffers.push_back(iovec{.iov_base = request.data.data() + offset, .iov_len = request.data.size() - offset});
+        }
+
+        const auto write_ret = writev(child_stdin_fd, buffers.data(), static_cast<int>(buffers.size()));
+        if (write_ret == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (!is_would_block(errno)) {
+                fail_all(std::format("failed to write to the server. Err is {}: {}", errno, strerror(errno)));
+                return;
+            }
+            // the pipe is full. Sleep until the server reads from it or we are asked to stop
+            if (wait_for_fd(child_stdin_fd, POLLOUT, stop_event.get_fd(), std::nullopt) == wait_result::failed) {
+                fail_all(std::format("failed to wait for the server. Err is {}: {}", errno, strerror(errno)));
+                return;
+            }
+            continue;
+        }
+
+        auto nr_bytes_left = static_cast<size_t>(write_ret);
+        while (nr_bytes_left > 0) {
+            const auto& first = pending.front();
+            const auto nr_bytes_left_in_first = first.data.size() - nr_bytes_written_of_first;
+            if (nr_bytes_left < nr_bytes_left_in_first) {
+                nr_bytes_written_of_first += nr_bytes_left;
+                break;
+            }
+            nr_bytes_left -= nr_bytes_left_in_first;
+            // the negotiations depend on the client, not on the session
+            if ((recorder != nullptr) && (first.request_id != reply_format_request_id) && (first.request_id != bulk_channel_request_id)) {
+                recorder->record_request(first.data);
+            }
+            queue.release(first.data.size());
+            pending.pop_front();
+            nr_bytes_written_of_first = 0;
+        }
+    }
+}
+
+auto ProgHandler::is_would_block(int err) noexcept -> bool {
+    if constexpr (EAGAIN != EWOULDBLOCK) {
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wlogical-op"
+        return (err == EAGAIN) || (err == EWOULDBLOCK);
+#pragma GCC diagnostic pop
+    } else {
+        return err == EAGAIN;
+    }
+}
+
+auto ProgHandler::wait_for_fd(int fd, short events, int wake_up_fd, std::optional<std::chrono::milliseconds> timeout) noexcept -> wait_result {
+    std::array<pollfd, 2> fds = {
+        pollfd{.fd = fd, .events = events, .revents = 0},
+        pollfd{.fd = wake_up_fd, .events = POLLIN, .revents = 0}, // poll ignores negative fds
+    };
+
+    const auto deadline = std::chrono::steady_clock::now() + timeout.value_or(std::chrono::milliseconds{0});
+    while (true) {
+        int timeout_ms = -1;
+        if (timeout.has_value()) {
+            const auto time_left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            timeout_ms = static_cast<int>(std::max(time_left.count(), std::chrono::milliseconds::rep{0}));
+        }
+
+        const auto poll_ret = poll(fds.data(), fds.size(), timeout_ms);
+        if (poll_ret == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return wait_result::failed;
+        }
+        if (poll_ret == 0) {
+            return wait_result::timed_out;
+        }
+        if (fds[1].revents != 0) {
+            return wait_result::woken_up;
+        }
+        // POLLHUP and POLLERR are reported as ready too, the following read or write call reports the actual error
+        return wait_result::ready;
+    }
+}
+
 namespace {
     bool is_process_alive(const int pid) {
         int status;
         const auto ret_code = waitpid(pid, &status, WNOHANG | WUNTRACED | WCONTINUED);
-        const auto is_alive = ret_code >= 0;
+        if (ret_code == 0) {
+            return true; // no state change
+        }
+        if (ret_code == -1) {
+            return false; // already reaped
+        }
+        // the call reaped the child if it died, otherwise it only got stopped or continued
+        const auto is_alive = (!WIFEXITED(status)) && (!WIFSIGNALED(status));
         return is_alive;
     }
 }
@@ -188,15 +415,24 @@ namespace {
 void ProgHandler::kill_child_after_timeout(const std::chrono::milliseconds timeout) noexcept {
     if (child.has_value()) {
         const auto pid = child.value().pid;
-        const auto max_wait_between_checks = std::chrono::milliseconds{5};
-        auto waited_time = std::chrono::milliseconds {0};
-
-        while ((is_process_alive(pid)) && (waited_time < timeout)) {
-            const auto max_time_to_wait = timeout - waited_time;
-            const auto time_to_wait = std::min(max_wait_between_checks, max_time_to_wait);
-            std::this_thread::sleep_for(time_to_wait);
-            waited_time += time_to_wait;
+
+        // a pidfd becomes readable when the process exits, so we can sleep exactly until then
+        if (const auto pid_fd = static_cast<int>(syscall(SYS_pidfd_open, pid, 0)); pid_fd != -1) {
+            [[maybe_unused]] const auto wait_ret = wait_for_fd(pid_fd, POLLIN, -1, timeout);
+            close(pid_fd);
+        } else {
+            // kernels older than 5.3 don't have pidfd_open.
+            const auto max_wait_between_checks = std::chrono::milliseconds{5};
+            auto waited_time = std::chrono::milliseconds {0};
+
+            while ((is_process_alive(pid)) && (waited_time < timeout)) {
+                const auto max_time_to_wait = timeout - waited_time;
+                const auto time_to_wait = std::min(max_wait_between_checks, max_time_to_wait);
+                std::this_thread::sleep_for(time_to_wait);
+                waited_time += time_to_wait;
+            }
         }
+
         if (is_process_alive(pid)) {
             kill_child();
         } else {
@@ -237,8 +473,9 @@ void ProgHandler::kill_child() noexcept {
     }
 }
 
-ProgHandler::ProgHandler(child_data_t child_data) noexcept
+ProgHandler::ProgHandler(child_data_t child_data, std::shared_ptr<bulk_channel> bulk_data_channel) noexcept
     : child(std::move(child_data))
+    , bulk(std::move(bulk_data_channel))
 {
 }
 
@@ -12,13 +12,28 @@
 #include <spawn.h>
 #include <format>
 #include <chrono>
+#include <algorithm>
+#include <vector>
+#include <iostream>
+#include <functional>
+#include <memory>
+#include <span>
 
 #include <fcntl.h>
+#include <poll.h>
 #include <unistd.h>
 #include <sys/wait.h>
 #include <sys/types.h>
 #include <signal.h>
 
+#include "bulk_channel.hh"
+#include "outbound_queue.hh"
+#include "protocol.hh"
+#include "receive_buffer.hh"
+#include "reply_framing.hh"
+#include "session_trace.hh"
+#include "wake_up_event.hh"
+
 class ProgHandler final {
 public:
     ProgHandler() = delete;
@@ -30,18 +45,78 @@ public:
 
     ~ProgHandler() noexcept;
 
-    static auto try_new(const char* const prog_exec) noexcept -> std::expected<ProgHandler, std::string>;
+    // prog_args are given to the server after its path, e.g. the workload of a fake server
+    static auto try_new(const char* const prog_exec, std::span<const char* const> prog_args = {}) noexcept -> std::expected<ProgHandler, std::string>;
 
+    // Writes msg directly, blocking until it is written or timeout expires. Must not be used while
+    // the request writer runs, as writes from both could interleave. Use queue_request instead.
     auto send_to_child(const std::string& msg, std::chrono::milliseconds timeout = std::chrono::milliseconds{50}) const -> bool;
 
+    // Queues a request for the writer thread. Never blocks. An error is returned if the request
+    // can't be queued. Failures happening later, when writing it, are reported to the on_send_failed_fn
+    // callback given to start_background_request_writer.
+    // Requests with a higher priority overtake the ones still waiting in the queue.
+    auto queue_request(std::string request_id, std::string request, request_priority priority = request_priority::interactive) -> std::expected<void, std::string>;
+
+    // Latest-wins: a request still in the queue is dropped before reaching the server, otherwise
+    // the server is asked to stop working on it. Either way, the caller shouldn't expect any reply.
+    auto cancel_request(std::string_view request_id) -> std::expected<void, std::string>;
+
+    // Records the requests written and the replies read from then on into recorder. Must be called
+    // before starting the background threads, which keep a reference to it.
+    void record_session(std::shared_ptr<session_recorder> recorder) noexcept;
+
+    // Starts the thread writing queued requests to the server. Once writing failed, the thread
+    // stops, and on_send_failed_fn is called with the request id and an error message for each
+    // request that couldn't be written, priority hints and cancels excepted.
+    template<typename ON_SEND_FAILED_FN>
+    auto start_background_request_writer(ON_SEND_FAILED_FN on_send_failed_fn) -> std::expected<std::jthread, int> {
+        if (!child.has_value()) {
+            return std::unexpected(4);
+        }
+        if (!requests_queue->is_valid()) {
+            return std::unexpected(5);
+        }
+        const auto child_stdin = child->stdin_fd;
+        std::jthread background_thread ([child_stdin = child_stdin, queue = requests_queue.get(), recorder = session_recording, on_send_failed_fn = std::move(on_send_failed_fn)] (std::stop_token stop_token) {
+            ProgHandler::write_requests_to_child(stop_token, child_stdin, *queue, recorder.get(), on_send_failed_fn);
+        });
+        return background_thread;
+    }
+
+    struct listener_options {
+        // When binary_frames, the server is asked to send its replies as binary frames.
+        // Servers not supporting it keep sending text lines.
+        wire_format preferred_format = wire_format::binary_frames;
+        // When true, the server is also asked to send big payloads through the shared memory
+        // bulk channel instead of the pipe. Only possible with binary frames.
+        bool use_bulk_channel = true;
+        receive_buffer_config buffer_config = {};
+    };
+
+    // Starts the thread reading replies from the server. on_message_received_fn is called with a
+    // server_message for each reply.
     template<typename ON_MSG_FN, typename ON_ERR_FN>
-    auto start_background_message_listener(ON_MSG_FN on_message_received_fn, ON_ERR_FN on_error_fn) -> std::expected<std::jthread, int> {
+    auto start_background_message_listener(ON_MSG_FN on_message_received_fn, ON_ERR_FN on_error_fn, listener_options options = {}) -> std::expected<std::jthread, int> {
         if (!child.has_value()) {
             return std::unexpected(4);
         }
+        if (options.preferred_format == wire_format::binary_frames) {
+            // the server replies with an ACK line and uses binary frames for everything it sends after it,
+            // or with an ERROR line if it doesn't know about binary frames. The reader handles both.
+            // goes through the queue too, so that it can't interleave with requests written by the writer thread
+            [[maybe_unused]] const auto queued = queue_request(std::string(reply_format_request_id), protocol::make_request({reply_format_request_id}, protocol::set_reply_format{}));
+        }
+        auto bulk_data_channel = std::shared_ptr<bulk_channel>(nullptr);
+        if ((options.preferred_format == wire_format::binary_frames) && (options.use_bulk_channel) && (bulk != nullptr)) {
+            // a server not knowing about it replies with an error, and keeps sending everything through the pipe
+            [[maybe_unused]] const auto queued = queue_request(std::string(bulk_channel_request_id),
+                                                               protocol::make_request({bulk_channel_request_id}, protocol::enable_bulk_channel{bulk_channel::server_fd_as_string}));
+            bulk_data_channel = bulk;
+        }
         const auto child_stdout = child->stdout_fd;
-        std::jthread background_thread ([child_stdout = child_stdout, on_message_received_fn = std::move(on_message_received_fn), on_error_fn = std::move(on_error_fn)] (std::stop_token stop_token) {
-            ProgHandler::get_line_from_child(stop_token, child_stdout, std::move(on_message_received_fn), std::move(on_error_fn));
+        std::jthread background_thread ([child_stdout = child_stdout, buffer_config = options.buffer_config, bulk_data_channel = std::move(bulk_data_channel), recorder = session_recording, on_message_received_fn = std::move(on_message_received_fn), on_error_fn = std::move(on_error_fn)] (std::stop_token stop_token) {
+            ProgHandler::get_messages_from_child(stop_token, child_stdout, buffer_config, bulk_data_channel.get(), recorder.get(), std::move(on_message_received_fn), std::move(on_error_fn));
         });
         return background_thread;
     }
@@ -58,84 +133,202 @@ private:
     };
 
     std::optional<child_data_t> child = std::nullopt;
+    // heap allocated so that the writer thread keeps a valid reference when the handler is moved
+    std::unique_ptr<outbound_queue> requests_queue = std::make_unique<outbound_queue>();
+    // shared with the reader thread, which hands out slices of it. nullptr if it couldn't be created.
+    std::shared_ptr<bulk_channel> bulk = nullptr;
+    // shared with the background threads. nullptr when the session isn't recorded.
+    std::shared_ptr<session_recorder> session_recording = nullptr;
 
 private:
-    ProgHandler(child_data_t child_data) noexcept;
+    ProgHandler(child_data_t child_data, std::shared_ptr<bulk_channel> bulk_data_channel) noexcept;
+
+    enum class wait_result {
+        ready,
+        woken_up, // the wake up fd was signalled
+        timed_out,
+        failed,
+    };
+
+    // Sleeps until fd reports one of the events, wake_up_fd (if not -1) becomes readable, or the
+    // timeout expires. No timeout means waiting forever.
+    static auto wait_for_fd(int fd, short events, int wake_up_fd, std::optional<std::chrono::milliseconds> timeout) noexcept -> wait_result;
+    static auto is_would_block(int err) noexcept -> bool __attribute__((const));
+
+    using send_failure_fn = std::function<void(std::string request_id, std::string reason)>;
+    static auto write_requests_to_child(std::stop_token stop_token, int child_stdin_fd, outbound_queue& queue, session_recorder* recorder, const send_failure_fn& on_send_failed_fn) -> void;
 
     template<typename ON_MSG_FN, typename ON_ERR_FN>
-    static auto get_line_from_child(std::stop_token stop_token, const int child_stdout_fd, ON_MSG_FN on_message_received_fn, ON_ERR_FN on_error_fn) -> void {
-        std::vector<std::uint8_t> storage;
-        size_t nr_bytes_used_in_storage = 0;
+    static auto get_messages_from_child(std::stop_token stop_token, const int child_stdout_fd, receive_buffer_config buffer_config, bulk_channel* bulk_data_channel, session_recorder* recorder, ON_MSG_FN on_message_received_fn, ON_ERR_FN on_error_fn) -> void {
+        receive_buffer storage(buffer_config);
+        size_t nr_bytes_scanned = 0; // in text mode, there is no '\n' in the first nr_bytes_scanned readable bytes
+        auto current_format = wire_format::text_lines;
 
-        // constexpr auto MiB = [](unsigned i) { const auto res = i * 1024 * 1024 ; return res; };
         constexpr auto KiB = [](unsigned i) { const auto res = i * 1024 ; return res; };
 
-        constexpr auto min_available_size = KiB(40);
-        auto storage_size = storage.size();
-        const auto nr_bytes_left_in_storage = [&](){ return storage_size - nr_bytes_used_in_storage; } ;
+        constexpr auto min_read_size = KiB(16);
 
-        while (!stop_token.stop_requested()) { // replaced with no cancel requested
-            bool got_line = false;
+        // the stop token doesn't interrupt a thread waiting for data, so a stop request signals
+        // this event which is polled together with the child's stdout.
+        const wake_up_event stop_event;
+        if (!stop_event.is_valid()) {
+            on_error_fn(std::format("failed to create an eventfd. Err is {}: {}\n", errno, strerror(errno)));
+            return;
+        }
+        const std::stop_callback wake_up_on_stop(stop_token, [&stop_event]() { stop_event.signal(); });
 
-            while ((!got_line) && (!stop_token.stop_requested())) {
-                if (nr_bytes_left_in_storage() < min_available_size) {
-                    storage_size += min_available_size;
-                    storage.resize(storage_size);
+        // returns the number of bytes read, 0 if nothing could be read for now, or nullopt
+        // if the child can't be read from anymore or a stop was requested.
+        const auto read_from_child = [&](std::uint8_t* dest, size_t max_nr_bytes) -> std::optional<size_t> {
+            const auto read_ret = read(child_stdout_fd, dest, max_nr_bytes);
+            if (read_ret == -1) {
+                if (errno == EINTR) {
+                    // nothing special to do. Just try again
+                } else if (is_would_block(errno)) {
+                    // sleep until the child writes something or a stop is requested
+                    switch (wait_for_fd(child_stdout_fd, POLLIN, stop_event.get_fd(), std::nullopt)) {
+                        case wait_result::ready:
+                            break;
+                        case wait_result::woken_up:
+                        case wait_result::timed_out:
+                            return std::nullopt;
+                        case wait_result::failed:
+                            on_error_fn(std::format("failed to wait for the child. Err is {}: {}\n", errno, strerror(errno)));
+                            return std::nullopt;
+                    }
+                } else {
+                    on_error_fn(std::format("failed to read from child. Err is {}: {}\n", errno, strerror(errno)));
+                    return std::nullopt;
                 }
+                return 0;
+            }
+            if (read_ret == 0) {
+                // this means EOF. The child closed the pipe (might have died)
+                // todo look at how to handle this. Maybe we can restart the server, or show an error message
+                return std::nullopt;
+            }
+            return static_cast<size_t>(read_ret);
+        };
 
-                auto *data_ptr = storage.data() + nr_bytes_used_in_storage;
-                auto read_ret = read(child_stdout_fd, data_ptr, nr_bytes_left_in_storage());
-                if (read_ret == -1) {
-                    if (errno == EINTR) {
-                        // nothing special to do. Just try again
-                    } else if (errno == EAGAIN) {
-                        // sleep to avoid busy looping
-                        std::this_thread::sleep_for(std::chrono::milliseconds(5));
-                    } else if (errno == EWOULDBLOCK) {
-                        // check for cancel requested
-                        // Shouldn't get here since we don't create the pipe with O_NONBLOCK
-                        std::this_thread::sleep_for(std::chrono::milliseconds(50));
-                    } else {
-                        on_error_fn(std::format("failed to read from child. Err is {}: {}\n", errno, strerror(errno)));
+        // reads more bytes from the child at the end of storage. Returns false if the child can't be read anymore
+        const auto fill_storage = [&]() -> bool {
+            const auto dest = storage.prepare(min_read_size);
+            const auto nr_read = read_from_child(dest.data(), dest.size());
+            if (!nr_read.has_value()) {
+                return false;
+            }
+            storage.commit(nr_read.value());
+            return true;
+        };
+
+        // returns the next nr_bytes bytes of the stream. If they are already in storage, they are shared
+        // from there. Otherwise they get their own chunk of exactly that size, and what is missing is read
+        // straight into it. The sizes come from the frame header, so there is no need to look at the bytes.
+        const auto read_exactly = [&](size_t nr_bytes) -> std::optional<byte_slice> {
+            if (storage.readable().size() >= nr_bytes) {
+                return storage.take(nr_bytes);
+            }
+
+            auto dest = std::make_shared_for_overwrite<std::uint8_t[]>(nr_bytes);
+            const auto nr_bytes_from_storage = storage.readable().size();
+            storage.take_into(std::span{dest.get(), nr_bytes_from_storage});
+            auto nr_bytes_filled = nr_bytes_from_storage;
+            while (nr_bytes_filled < nr_bytes) {
+                if (stop_token.stop_requested()) {
+                    return std::nullopt;
+                }
+                const auto nr_read = read_from_child(dest.get() + nr_bytes_filled, nr_bytes - nr_bytes_filled);
+                if (!nr_read.has_value()) {
+                    return std::nullopt;
+                }
+                nr_bytes_filled += nr_read.value();
+            }
+            auto* const data_ptr = dest.get();
+            return byte_slice(std::move(dest), data_ptr, nr_bytes);
+        };
+
+        const auto deliver = [&](server_message msg) {
+            if (msg.request_id == bulk_channel_request_id) {
+                return;
+            }
+            if (msg.request_id == reply_format_request_id) {
+                // an error reply only means the server doesn't know about binary frames. Keep using text lines then.
+                if (msg.kind == reply_kind::ack) {
+                    current_format = wire_format::binary_frames;
+                }
+                return;
+            }
+            if (recorder != nullptr) {
+                recorder->record_reply(msg);
+            }
+            on_message_received_fn(std::move(msg));
+        };
+
+        while (!stop_token.stop_requested()) {
+            if (current_format == wire_format::text_lines) {
+                const auto readable = storage.readable();
+                const auto newline_pos = std::find(readable.begin() + static_cast<std::ptrdiff_t>(nr_bytes_scanned), readable.end(), '\n');
+                if (newline_pos == readable.end()) {
+                    nr_bytes_scanned = readable.size();
+                    if (!fill_storage()) {
                         return;
                     }
-                } else if (read_ret == 0) {
-                    // this means EOF. The child closed the pipe (might have died)
-                    // todo look at how to handle this. Maybe we can restart the server, or show an error message
-                    return;
+                    continue;
+                }
+
+                const auto line_size = static_cast<size_t>(newline_pos - readable.begin()) + 1; // keep the '\n'
+                const auto line = storage.take(line_size);
+                nr_bytes_scanned = 0;
+                if (auto msg = parse_line_message(line); msg.has_value()) {
+                    deliver(std::move(msg.value()));
                 } else {
-                    nr_bytes_used_in_storage += static_cast<size_t>(read_ret);
-                    const auto end_it = data_ptr + read_ret;
-                    const auto newline_pos = std::find(data_ptr, end_it, '\n');
-                    got_line = (newline_pos != end_it);
+                    std::cout << std::format("Error: can't parse message from the server: {}", line.as_string_view());
+                }
+            } else {
+                if (storage.readable().size() < frame_header::wire_size) {
+                    if (!fill_storage()) {
+                        return;
+                    }
+                    continue;
                 }
-            }
 
-            // we got at least one line, and the end might not be \n terminated.
-            auto *current_str_begin = storage.data();
-            auto *const end_storage = storage.data() + nr_bytes_used_in_storage;
-            decltype(current_str_begin) next_endline;
-            do {
-                next_endline = std::find(current_str_begin, end_storage, '\n');
-                if (next_endline != end_storage) {
-                    assert(next_endline < end_storage);
-                    auto *const next_begin_str = std::next(next_endline);
-                    auto curr_str = std::string(current_str_begin, next_begin_str); // keep the '\n' in the string
-                    on_message_received_fn(std::move(curr_str));
-                    current_str_begin = next_begin_str;
+                const auto header = parse_frame_header(storage.readable().data());
+                if (!header.has_value()) {
+                    // there is no way to find the beginning of the next frame
+                    on_error_fn(std::string("received a corrupted frame from the server. No further reply can be read\n"));
+                    return;
+                }
+                storage.take(frame_header::wire_size);
+
+                const auto request_id = read_exactly(header->request_id_size);
+                if (!request_id.has_value()) {
+                    return;
                 }
-            } while (next_endline < end_storage);
-
-            assert(next_endline == end_storage);
-            assert(current_str_begin <= end_storage);
-
-            // from current_str_begin up to end_storage, there is no '\n' left.
-            // move that part to the beginning of the vector
-            const auto nr_bytes_after_last_ending = end_storage - current_str_begin;
-            assert(nr_bytes_after_last_ending >= 0);
-            const auto nr_bytes_after_last_ending_unsigned = static_cast<size_t>(nr_bytes_after_last_ending);
-            std::memmove(storage.data(), current_str_begin, nr_bytes_after_last_ending_unsigned);
-            nr_bytes_used_in_storage = nr_bytes_after_last_ending_unsigned;
+                auto payload = read_exactly(header->payload_size);
+                if (!payload.has_value()) {
+                    return;
+                }
+                if (header->is_bulk) {
+                    // the frame only tells where the payload is in the shared ring
+                    const auto descriptor = parse_bulk_descriptor(payload.value());
+                    if ((bulk_data_channel == nullptr) || (!descriptor.has_value())) {
+                        on_error_fn(std::format("received a bulk reply for {} without a bulk channel\n", request_id->as_string_view()));
+                        continue;
+                    }
+                    auto bulk_payload = bulk_data_channel->take(descriptor.value());
+                    if (!bulk_payload.has_value()) {
+                        on_error_fn(std::format("received a bulk reply for {}: {}\n", request_id->as_string_view(), bulk_payload.error()));
+                        continue;
+                    }
+                    payload = std::move(bulk_payload.value());
+                }
+                deliver(server_message{
+                    .request_id = std::string(request_id->as_string_view()),
+                    .kind = header->kind,
+                    .encoding = payload_encoding::raw_bytes,
+                    .payload = std::move(payload.value()),
+                });
+            }
         }
     }
 };
@@ -0,0 +1,203 @@
+#include <algorithm>
+#include <format>
+#include <memory>
+
+#include "protocol.hh"
+#include "utils.hh"
+
+namespace {
+    template <protocol::command Cmd>
+    constexpr auto encodes_to(const protocol::request_id& id, const Cmd& cmd, std::string_view expected) -> bool {
+        std::array<char, 256> buffer = {};
+        if (protocol::encoded_size(id, cmd) != expected.size()) {
+            return false;
+        }
+        const auto encoded = protocol::encode_request(buffer, id, cmd);
+        return std::string_view(encoded.data(), encoded.size()) == expected;
+    }
+
+    static_assert(encodes_to({"issue-ticket-list", 42}, protocol::fetch_ticket_list{}, "issue-ticket-list-42 FETCH_TICKET_LIST\n"));
+    static_assert(encodes_to({"PRJ-12-fetch-html", 7}, protocol::fetch_ticket{"PRJ-12"}, "PRJ-12-fetch-html-7 FETCH_TICKET PRJ-12,HTML\n"));
+    static_assert(encodes_to({"PRJ-12-fetch-html", 8}, protocol::fetch_ticket_if_modified{"PRJ-12", "cbf29ce484222325"},
+                             "PRJ-12-fetch-html-8 FETCH_TICKET_IF_MODIFIED PRJ-12,HTML,cbf29ce484222325\n"));
+    static_assert(encodes_to({"PRJ-12-fetch-key-value-list", 10}, protocol::fetch_ticket_key_value_fields{"PRJ-12"},
+                             "PRJ-12-fetch-key-value-list-10 FETCH_TICKET_KEY_VALUE_FIELDS PRJ-12\n"));
+    static_assert(encodes_to({"PRJ-12-fetch-attachment-list", 1234567890}, protocol::fetch_attachment_list_for_ticket{"PRJ-12"},
+                             "PRJ-12-fetch-attachment-list-1234567890 FETCH_ATTACHMENT_LIST_FOR_TICKET PRJ-12\n"));
+    static_assert(encodes_to({"dl-for-abcd", 3}, protocol::fetch_attachment_content{"abcd"}, "dl-for-abcd-3 FETCH_ATTACHMENT_CONTENT abcd\n"));
+    static_assert(encodes_to({"synchronise-projects", 1}, protocol::synchronise_updated{}, "synchronise-projects-1 SYNCHRONISE_UPDATED\n"));
+    static_assert(encodes_to({"synchronise-all", 18446744073709551615u}, protocol::synchronise_all{},
+                             "synchronise-all-18446744073709551615 SYNCHRONISE_ALL\n"));
+    static_assert(encodes_to({reply_format_request_id}, protocol::set_reply_format{},
+                             "reply-format-negotiation SET_REPLY_FORMAT BINARY_FRAMES\n"));
+    static_assert(encodes_to({bulk_channel_request_id}, protocol::enable_bulk_channel{"3"},
+                             "bulk-channel-negotiation ENABLE_BULK_CHANNEL 3\n"));
+    static_assert(encodes_to({"cancel-PRJ-12-fetch-html-7"}, protocol::cancel{"PRJ-12-fetch-html-7"},
+                             "cancel-PRJ-12-fetch-html-7 CANCEL PRJ-12-fetch-html-7\n"));
+    static_assert(encodes_to({priority_hint_request_id}, protocol::set_request_priority{"dl-for-abcd-3", request_priority::bulk},
+                             "priority-hint SET_REQUEST_PRIORITY dl-for-abcd-3,BULK\n"));
+    static_assert(encodes_to({"exit-immediately"}, protocol::exit_server_now{}, "exit-immediately EXIT_SERVER_NOW\n"));
+    static_assert(protocol::get_request_id("exit-immediately EXIT_SERVER_NOW\n") == "exit-immediately");
+
+    // the returned views point into input
+    auto split(std::string_view input, char separator, std::pmr::memory_resource* memory) -> std::pmr::vector<std::string_view> {
+        std::pmr::vector<std::string_view> res(memory);
+        if (input.empty()) {
+            return res;
+        }
+        res.reserve(static_cast<size_t>(std::count(input.cbegin(), input.cend(), separator)) + 1);
+        while (true) {
+            const auto pos = input.find(separator);
+            res.emplace_back(input.substr(0, pos));
+            // like std::getline, a trailing separator doesn't start a new empty element
+            if ((pos == std::string_view::npos) || (pos + 1 == input.size())) {
+                break;
+            }
+            input.remove_prefix(pos + 1);
+        }
+        return res;
+    }
+
+    auto base64_decode_to_string(std::string_view input, std::pmr::memory_resource* memory) -> std::expected<std::pmr::string, std::string> {
+        const auto decoded_size = base64_decoded_size(input);
+        std::pmr::string res(memory);
+        // the size given to the callback may be the capacity, which can be larger
+        res.resize_and_overwrite(decoded_size, [decoded_size](char*, size_t) { return decoded_size; });
+        auto decoded = base64_decode_into(input, std::span(reinterpret_cast<std::uint8_t*>(res.data()), res.size()));
+        if (!decoded.has_value()) {
+            return std::unexpected(std::move(decoded.error()));
+        }
+        return res;
+    }
+
+    auto get_binary_payload(const server_message& msg) noexcept -> protocol::binary_payload {
+        return protocol::binary_payload{ .encoding = msg.encoding, .bytes = msg.payload };
+    }
+
+    template <typename Elem>
+    struct decoded_pairs {
+        std::pmr::vector<Elem> elements;
+        std::pmr::vector<protocol::pair_error> errors;
+    };
+
+    // Pairs are decoded in a single pass over the payload, each key and value straight into its
+    // final string. Binary frames hold raw bytes. In text lines, values are always base64 encoded,
+    // keys depend on the command. Pairs failing to decode are returned apart, only a payload
+    // which can't be split into pairs fails as a whole.
+    // Elem must be constructible from the decoded key and value strings.
+    template <typename Elem>
+    auto decode_pairs(const server_message& msg, bool is_key_encoded, std::pmr::memory_resource* memory)
+            -> std::expected<decoded_pairs<Elem>, std::string> {
+        const auto is_text = msg.encoding == payload_encoding::base64_text;
+        const auto decode_field = [&](std::string_view field, bool is_encoded) {
+            return (is_text && is_encoded) ? base64_decode_to_string(field, memory)
+                                           : std::expected<std::pmr::string, std::string>(std::in_place, field, memory);
+        };
+
+        auto reader = pair_reader(msg.payload.as_string_view(), msg.encoding);
+        auto res = decoded_pairs<Elem>{ .elements = std::pmr::vector<Elem>(memory), .errors = std::pmr::vector<protocol::pair_error>(memory) };
+        res.elements.reserve(reader.count_hint());
+        while (const auto kv = reader.next()) {
+            auto key = decode_field(kv->key, is_key_encoded);
+            auto value = decode_field(kv->value, true);
+            if ((!key.has_value()) || (!value.has_value())) {
+                res.errors.push_back({ .key = std::pmr::string(kv->key, memory),
+                                       .value = std::pmr::string(kv->value, memory),
+                                       .reason = std::pmr::string(key.has_value() ? value.error() : key.error(), memory) });
+                continue;
+            }
+            res.elements.emplace_back(std::move(key.value()), std::move(value.value()));
+        }
+        if (reader.is_malformed()) {
+            if (is_text) {
+                const auto remaining = reader.remaining();
+                return std::unexpected(std::format("invalid encoded data found in reply to {}. Expected a key value pair separated by a colon. Got {}",
+                                                   msg.request_id, remaining.substr(0, remaining.find(','))));
+            }
+            return std::unexpected(std::format("invalid key/value list in reply to {}. {} bytes left undecoded",
+                                               msg.request_id, reader.remaining().size()));
+        }
+        return res;
+    }
+}
+
+namespace protocol {
+
+    auto content_hash(std::span<const std::uint8_t> data, std::uint64_t seed) noexcept -> std::uint64_t {
+        auto hash = seed;
+        for (const auto byte : data) {
+            hash ^= byte;
+            hash *= std::uint64_t{1099511628211U};
+        }
+        return hash;
+    }
+
+    auto content_hash_text(std::uint64_t hash) -> std::string {
+        return std::format("{:016x}", hash);
+    }
+
+    auto binary_payload::size() const noexcept -> size_t {
+        if (encoding == payload_encoding::raw_bytes) {
+            return bytes.size();
+        }
+        return base64_decoded_size(bytes.as_string_view());
+    }
+
+    auto binary_payload::decode_into(std::span<std::uint8_t> dest) const -> std::expected<void, std::string> {
+        if (encoding == payload_encoding::base64_text) {
+            return base64_decode_into(bytes.as_string_view(), dest);
+        }
+        if (dest.size() != bytes.size()) {
+            return std::unexpected(std::format("Decoding needs a buffer of {} bytes, got {}", bytes.size(), dest.size()));
+        }
+        std::copy(bytes.data(), bytes.data() + bytes.size(), dest.data());
+        return {};
+    }
+
+    auto binary_payload::write_to(int fd) const -> std::expected<void, std::string> {
+        if (encoding == payload_encoding::base64_text) {
+            return base64_decode_to_fd(bytes.as_string_view(), fd);
+        }
+        return write_all(fd, bytes.as_span());
+    }
+
+    auto no_result::decode(const server_message&, std::pmr::memory_resource*) -> std::expected<no_result, std::string> {
+        return no_result{};
+    }
+
+    auto ticket_list::decode(const server_message& msg, std::pmr::memory_resource* memory) -> std::expected<ticket_list, std::string> {
+        // the ticket list is plain text in both wire formats
+        const auto keys = split(msg.payload.as_string_view(), ',', memory);
+        auto res = ticket_list{ .keys = std::pmr::vector<std::pmr::string>(memory) };
+        res.keys.reserve(keys.size());
+        for (const auto& key : keys) {
+            res.keys.emplace_back(key);
+        }
+        return res;
+    }
+
+    auto ticket_page::decode(const server_message& msg, std::pmr::memory_resource*) -> std::expected<ticket_page, std::string> {
+        return ticket_page{ .html = get_binary_payload(msg) };
+    }
+
+    auto ticket_properties::decode(const server_message& msg, std::pmr::memory_resource* memory) -> std::expected<ticket_properties, std::string> {
+        auto properties = decode_pairs<kv_pair>(msg, true, memory);
+        if (!properties.has_value()) {
+            return std::unexpected(std::move(properties.error()));
+        }
+        return ticket_properties{ .properties = std::move(properties->elements), .errors = std::move(properties->errors) };
+    }
+
+    auto attachment_list::decode(const server_message& msg, std::pmr::memory_resource* memory) -> std::expected<attachment_list, std::string> {
+        // uuids are sent as is, only file names are base64 encoded in text lines
+        auto attachments = decode_pairs<attachment>(msg, false, memory);
+        if (!attachments.has_value()) {
+            return std::unexpected(std::move(attachments.error()));
+        }
+        return attachment_list{ .attachments = std::move(attachments->elements), .errors = std::move(attachments->errors) };
+    }
+
+    auto attachment_content::decode(const server_message& msg, std::pmr::memory_resource*) -> std::expected<attachment_content, std::string> {
+        return attachment_content{ .data = get_binary_payload(msg) };
+    }
+}
@@ -0,0 +1,290 @@
+#pragma once
+
+#include <array>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <memory_resource>
+#include <ranges>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "receive_buffer.hh"
+#include "reply_framing.hh"
+#include "request_priority.hh"
+
+// Schema of the commands understood by local_jira. Every command is a type giving its verb,
+// its arguments, and the type its RESULT replies decode into. Requests look like
+//      <request id> <VERB>[ <arg1>,<arg2>,...]\n
+// The encoders below are constexpr and write into a caller provided buffer, so they never
+// allocate, and the format is checked at compile time (see the static_asserts in protocol.cc).
+namespace protocol {
+
+    // Decoded payloads of RESULT replies. Each one knows how to decode itself from both
+    // wire formats. Everything decoding allocates comes from memory, typically the arena of
+    // the reply (see reply_arena.hh), so decoded values must not outlive it.
+    struct no_result {
+        static auto decode(const server_message& msg, std::pmr::memory_resource* memory = std::pmr::get_default_resource())
+                -> std::expected<no_result, std::string>;
+    };
+
+    struct ticket_list {
+        std::pmr::vector<std::pmr::string> keys;
+        static auto decode(const server_message& msg, std::pmr::memory_resource* memory = std::pmr::get_default_resource())
+                -> std::expected<ticket_list, std::string>;
+    };
+
+    // Binary data of a RESULT reply. It is only decoded once the caller says where it should
+    // go, so text lines are base64 decoded straight into their final destination, and frames
+    // are used as is.
+    struct binary_payload {
+        payload_encoding encoding;
+        byte_slice bytes; // shares the reply's storage
+
+        // number of bytes of the decoded data
+        auto size() const noexcept -> size_t;
+        // dest must be exactly size() bytes long
+        auto decode_into(std::span<std::uint8_t> dest) const -> std::expected<void, std::string>;
+        // fd must be blocking. Large payloads are written without being decoded in memory as a whole.
+        auto write_to(int fd) const -> std::expected<void, std::string>;
+    };
+
+    struct ticket_page {
+        binary_payload html;
+        static auto decode(const server_message& msg, std::pmr::memory_resource* memory = std::pmr::get_default_resource())
+                -> std::expected<ticket_page, std::string>;
+    };
+
+    // Entry of a key/value list which couldn't be decoded. The other entries of the list are
+    // decoded anyway, a single bad one doesn't make the whole reply unusable.
+    struct pair_error {
+        std::pmr::string key; // as received
+        std::pmr::string value; // as received
+        std::pmr::string reason;
+    };
+
+    struct ticket_properties {
+        std::pmr::vector<kv_pair> properties;
+        std::pmr::vector<pair_error> errors;
+        static auto decode(const server_message& msg, std::pmr::memory_resource* memory = std::pmr::get_default_resource())
+                -> std::expected<ticket_properties, std::string>;
+    };
+
+    struct attachment {
+        std::pmr::string uuid;
+        std::pmr::string filename;
+    };
+
+    struct attachment_list {
+        std::pmr::vector<attachment> attachments;
+        std::pmr::vector<pair_error> errors;
+        static auto decode(const server_message& msg, std::pmr::memory_resource* memory = std::pmr::get_default_resource())
+                -> std::expected<attachment_list, std::string>;
+    };
+
+    struct attachment_content {
+        binary_payload data;
+        static auto decode(const server_message& msg, std::pmr::memory_resource* memory = std::pmr::get_default_resource())
+                -> std::expected<attachment_content, std::string>;
+    };
+
+    template <typename Cmd>
+    concept command = requires (const Cmd& cmd) {
+        { Cmd::verb } -> std::convertible_to<std::string_view>;
+        { cmd.arguments() } -> std::ranges::contiguous_range;
+        { Cmd::result::decode(std::declval<const server_message&>()) };
+    };
+
+    // Arguments are sent as is: they can't contain ',', ' ' or '\n'. Ticket keys and uuids never do.
+    struct fetch_ticket_list {
+        static constexpr std::string_view verb = "FETCH_TICKET_LIST";
+        using result = ticket_list;
+        constexpr auto arguments() const noexcept -> std::array<std::string_view, 0> { return {}; }
+    };
+
+    struct fetch_ticket {
+        static constexpr std::string_view verb = "FETCH_TICKET";
+        using result = ticket_page;
+        std::string_view ticket_key;
+        constexpr auto arguments() const noexcept -> std::array<std::string_view, 2> { return {ticket_key, "HTML"}; }
+    };
+
+    // Like fetch_ticket, for a client already holding a version of the page whose content_hash
+    // is known_hash. When the page didn't change since, the server replies NOT_MODIFIED instead
+    // of RESULT, without payload. Servers not knowing the verb reply with an error.
+    struct fetch_ticket_if_modified {
+        static constexpr std::string_view verb = "FETCH_TICKET_IF_MODIFIED";
+        using result = ticket_page;
+        std::string_view ticket_key;
+        std::string_view known_hash; // as written by content_hash_text
+        constexpr auto arguments() const noexcept -> std::array<std::string_view, 3> { return {ticket_key, "HTML", known_hash}; }
+    };
+
+    struct fetch_ticket_key_value_fields {
+        static constexpr std::string_view verb = "FETCH_TICKET_KEY_VALUE_FIELDS";
+        using result = ticket_properties;
+        std::string_view ticket_key;
+        constexpr auto arguments() const noexcept -> std::array<std::string_view, 1> { return {ticket_key}; }
+    };
+
+    struct fetch_attachment_list_for_ticket {
+        static constexpr std::string_view verb = "FETCH_ATTACHMENT_LIST_FOR_TICKET";
+        using result = attachment_list;
+        std::string_view ticket_key;
+        constexpr auto arguments() const noexcept -> std::array<std::string_view, 1> { return {ticket_key}; }
+    };
+
+    struct fetch_attachment_content {
+        static constexpr std::string_view verb = "FETCH_ATTACHMENT_CONTENT";
+        using result = attachment_content;
+        std::string_view attachment_uuid;
+        constexpr auto arguments() const noexcept -> std::array<std::string_view, 1> { return {attachment_uuid}; }
+    };
+
+    struct synchronise_updated {
+        static constexpr std::string_view verb = "SYNCHRONISE_UPDATED";
+        using result = no_result;
+        constexpr auto arguments() const noexcept -> std::array<std::string_view, 0> { return {}; }
+    };
+
+    struct synchronise_all {
+        static constexpr std::string_view verb = "SYNCHRONISE_ALL";
+        using result = no_result;
+        constexpr auto arguments() const noexcept -> std::array<std::string_view, 0> { return {}; }
+    };
+
+    struct set_reply_format {
+        static constexpr std::string_view verb = "SET_REPLY_FORMAT";
+        using result = no_result;
+        constexpr auto arguments() const noexcept -> std::array<std::string_view, 1> { return {"BINARY_FRAMES"}; }
+    };
+
+    // the argument is the fd number the shared ring has in the server process (see bulk_channel.hh)
+    struct enable_bulk_channel {
+        static constexpr std::string_view verb = "ENABLE_BULK_CHANNEL";
+        using result = no_result;
+        std::string_view server_fd;
+        constexpr auto arguments() const noexcept -> std::array<std::string_view, 1> { return {server_fd}; }
+    };
+
+    // The server stops working on the given request and ends it with a FINISHED reply.
+    // Replies to the cancel request itself can be ignored.
+    struct cancel {
+        static constexpr std::string_view verb = "CANCEL";
+        using result = no_result;
+        std::string_view request_id;
+        constexpr auto arguments() const noexcept -> std::array<std::string_view, 1> { return {request_id}; }
+    };
+
+    // Sent just before a request which isn't interactive. Servers not knowing about priorities
+    // reply with an error, and handle requests in the order they come.
+    struct set_request_priority {
+        static constexpr std::string_view verb = "SET_REQUEST_PRIORITY";
+        using result = no_result;
+        std::string_view request_id;
+        request_priority priority;
+        constexpr auto arguments() const noexcept -> std::array<std::string_view, 2> { return {request_id, to_wire_name(priority)}; }
+    };
+
+    struct exit_server_now {
+        static constexpr std::string_view verb = "EXIT_SERVER_NOW";
+        using result = no_result;
+        constexpr auto arguments() const noexcept -> std::array<std::string_view, 0> { return {}; }
+    };
+
+    // Hash identifying a version of a ticket page, computed by both sides on the decoded HTML:
+    // 64 bits FNV-1a. It is sent as 16 lowercase hexadecimal digits.
+    // Giving the hash of some data as seed continues it: hashing a then b with it gives the
+    // hash of a and b concatenated.
+    inline constexpr std::uint64_t content_hash_seed = std::uint64_t{14695981039346656037U};
+    auto content_hash(std::span<const std::uint8_t> data, std::uint64_t seed = content_hash_seed) noexcept -> std::uint64_t;
+    auto content_hash_text(std::uint64_t hash) -> std::string;
+
+    // Sent as "<name>-<number>", or just "<name>" when number is 0.
+    struct request_id {
+        std::string_view name;
+        std::uint64_t number = 0;
+    };
+
+    constexpr auto nr_decimal_digits(std::uint64_t n) noexcept -> size_t {
+        size_t res = 1;
+        while (n >= 10) {
+            n /= 10;
+            ++res;
+        }
+        return res;
+    }
+
+    constexpr auto encoded_size(const request_id& id) noexcept -> size_t {
+        return id.name.size() + ((id.number == 0) ? 0 : 1 + nr_decimal_digits(id.number));
+    }
+
+    template <command Cmd>
+    constexpr auto encoded_size(const request_id& id, const Cmd& cmd) noexcept -> size_t {
+        auto res = encoded_size(id) + 1 + Cmd::verb.size() + 1; // spaces and '\n'
+        const auto args = cmd.arguments();
+        for (const auto& arg : args) {
+            res += 1 + arg.size(); // ' ' before the first argument, ',' before the others
+        }
+        return res;
+    }
+
+    // dest must be at least encoded_size(id, cmd) bytes long. Returns the part of dest written to.
+    template <command Cmd>
+    constexpr auto encode_request(std::span<char> dest, const request_id& id, const Cmd& cmd) noexcept -> std::span<char> {
+        size_t pos = 0;
+        const auto append = [&](std::string_view s) {
+            for (const auto c : s) {
+                dest[pos++] = c;
+            }
+        };
+
+        append(id.name);
+        if (id.number != 0) {
+            dest[pos++] = '-';
+            auto n = id.number;
+            const auto nr_digits = nr_decimal_digits(n);
+            for (size_t i = nr_digits; i > 0; --i) {
+                dest[pos + i - 1] = static_cast<char>('0' + (n % 10));
+                n /= 10;
+            }
+            pos += nr_digits;
+        }
+        dest[pos++] = ' ';
+        append(Cmd::verb);
+
+        const auto args = cmd.arguments();
+        for (size_t i = 0; i < args.size(); ++i) {
+            dest[pos++] = (i == 0) ? ' ' : ',';
+            append(args[i]);
+        }
+        dest[pos++] = '\n';
+        return dest.first(pos);
+    }
+
+    // The string is allocated once, with its final size.
+    template <command Cmd>
+    auto make_request(const request_id& id, const Cmd& cmd) -> std::string {
+        std::string res;
+        res.resize_and_overwrite(encoded_size(id, cmd), [&](char* data, size_t size) {
+            return encode_request(std::span<char>(data, size), id, cmd).size();
+        });
+        return res;
+    }
+
+    // request id part of an encoded request
+    constexpr auto get_request_id(std::string_view encoded_request) noexcept -> std::string_view {
+        return encoded_request.substr(0, encoded_request.find(' '));
+    }
+
+    // msg must be a RESULT reply to a request of type Cmd
+    template <command Cmd>
+    auto decode_result(const server_message& msg, std::pmr::memory_resource* memory = std::pmr::get_default_resource())
+            -> std::expected<typename Cmd::result, std::string> {
+        return Cmd::result::decode(msg, memory);
+    }
+}
@@ -0,0 +1,79 @@
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include "receive_buffer.hh"
+
+receive_buffer::receive_buffer(receive_buffer_config buffer_config) noexcept
+    : config(buffer_config)
+{
+}
+
+auto receive_buffer::prepare(size_t min_nr_bytes) -> std::span<std::uint8_t> {
+    if ((chunk != nullptr) && (chunk_capacity - nr_bytes_used >= min_nr_bytes)) {
+        return {chunk.get() + nr_bytes_used, chunk_capacity - nr_bytes_used};
+    }
+
+    const auto nr_bytes_unconsumed = nr_bytes_used - nr_bytes_consumed;
+    const auto nr_bytes_needed = nr_bytes_unconsumed + min_nr_bytes;
+
+    // moving bytes around in the current chunk is only possible when no slice points into it.
+    // use_count can't go up behind our back since only this object creates slices.
+    if ((chunk != nullptr) && (chunk.use_count() == 1) && (nr_bytes_needed <= chunk_capacity)) {
+        std::memmove(chunk.get(), chunk.get() + nr_bytes_consumed, nr_bytes_unconsumed);
+    } else {
+        auto new_capacity = std::max(config.initial_capacity, chunk_capacity);
+        while (new_capacity < nr_bytes_needed) {
+            new_capacity *= 2;
+        }
+        auto new_chunk = std::make_shared_for_overwrite<std::uint8_t[]>(new_capacity);
+        if (nr_bytes_unconsumed > 0) {
+            std::memcpy(new_chunk.get(), chunk.get() + nr_bytes_consumed, nr_bytes_unconsumed);
+        }
+        chunk = std::move(new_chunk);
+        chunk_capacity = new_capacity;
+    }
+    nr_bytes_used = nr_bytes_unconsumed;
+    nr_bytes_consumed = 0;
+
+    return {chunk.get() + nr_bytes_used, chunk_capacity - nr_bytes_used};
+}
+
+void receive_buffer::commit(size_t nr_bytes) noexcept {
+    assert(nr_bytes_used + nr_bytes <= chunk_capacity);
+    nr_bytes_used += nr_bytes;
+}
+
+auto receive_buffer::readable() const noexcept -> std::span<const std::uint8_t> {
+    if (chunk == nullptr) {
+        return {};
+    }
+    return {chunk.get() + nr_bytes_consumed, nr_bytes_used - nr_bytes_consumed};
+}
+
+auto receive_buffer::take(size_t nr_bytes) -> byte_slice {
+    assert(nr_bytes <= nr_bytes_used - nr_bytes_consumed);
+    auto res = byte_slice(chunk, chunk.get() + nr_bytes_consumed, nr_bytes);
+    nr_bytes_consumed += nr_bytes;
+    release_memory_if_above_high_water_mark();
+    return res;
+}
+
+void receive_buffer::take_into(std::span<std::uint8_t> dest) noexcept {
+    assert(dest.size() <= nr_bytes_used - nr_bytes_consumed);
+    if (!dest.empty()) {
+        std::memcpy(dest.data(), chunk.get() + nr_bytes_consumed, dest.size());
+    }
+    nr_bytes_consumed += dest.size();
+    release_memory_if_above_high_water_mark();
+}
+
+void receive_buffer::release_memory_if_above_high_water_mark() noexcept {
+    // slices handed over keep the chunk alive until they are dropped
+    if ((nr_bytes_consumed == nr_bytes_used) && (chunk_capacity > config.high_water_mark)) {
+        chunk.reset();
+        chunk_capacity = 0;
+        nr_bytes_used = 0;
+        nr_bytes_consumed = 0;
+    }
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <utility>
+
+// Read-only view on bytes kept alive by a reference counted owner. Copying a slice
+// only bumps the reference count, so messages can be handed over to other threads
+// without copying their content.
+class byte_slice final {
+public:
+    byte_slice() = default;
+    byte_slice(std::shared_ptr<const void> data_owner, const std::uint8_t* data_begin, size_t data_size) noexcept
+        : owner(std::move(data_owner))
+        , ptr(data_begin)
+        , len(data_size)
+    {
+    }
+    byte_slice(const byte_slice&) = default;
+    byte_slice(byte_slice&&) noexcept = default;
+    byte_slice& operator=(const byte_slice&) = default;
+    byte_slice& operator=(byte_slice&&) noexcept = default;
+    ~byte_slice() = default;
+
+    auto data() const noexcept -> const std::uint8_t* { return ptr; }
+    auto size() const noexcept -> size_t { return len; }
+    auto empty() const noexcept -> bool { return len == 0; }
+
+    auto as_string_view() const noexcept -> std::string_view {
+        return {reinterpret_cast<const char*>(ptr), len};
+    }
+
+    auto as_span() const noexcept -> std::span<const std::uint8_t> {
+        return {ptr, len};
+    }
+
+    // offset and nr_bytes must be within the slice
+    auto subslice(size_t offset, size_t nr_bytes) const noexcept -> byte_slice {
+        return byte_slice(owner, ptr + offset, nr_bytes);
+    }
+
+    auto subslice(size_t offset) const noexcept -> byte_slice {
+        return subslice(offset, len - offset);
+    }
+
+private:
+    std::shared_ptr<const void> owner = nullptr;
+    const std::uint8_t* ptr = nullptr;
+    size_t len = 0;
+};
+
+struct receive_buffer_config {
+    // size of the buffer when it is (re)allocated
+    size_t initial_capacity = size_t{64} * 1024;
+    // once the buffer grew above this size to receive a big message, the memory is
+    // given back as soon as no partial message is left in it.
+    size_t high_water_mark = size_t{4} * 1024 * 1024;
+};
+
+// Buffer receiving bytes from a pipe. Bytes are appended at the end with prepare/commit,
+// and consumed from the front with take, which hands them over as slices sharing the
+// underlying chunk.
+// Chunks are never modified once bytes from them were handed over. Only the bytes of the
+// last partial message are copied when more room is needed, and the capacity grows
+// geometrically, so receiving a very long message costs an amortised constant number of
+// copies per byte.
+class receive_buffer final {
+public:
+    explicit receive_buffer(receive_buffer_config config = {}) noexcept;
+
+    // returns a writable area of at least min_nr_bytes at the end of the buffer
+    auto prepare(size_t min_nr_bytes) -> std::span<std::uint8_t>;
+    // marks nr_bytes from the area returned by prepare as received
+    void commit(size_t nr_bytes) noexcept;
+
+    // bytes received but not consumed yet
+    auto readable() const noexcept -> std::span<const std::uint8_t>;
+
+    // consumes the first nr_bytes readable bytes and returns them without copying
+    auto take(size_t nr_bytes) -> byte_slice;
+    // consumes the first nr_bytes readable bytes, copying them into dest
+    void take_into(std::span<std::uint8_t> dest) noexcept;
+
+    auto capacity() const noexcept -> size_t { return chunk_capacity; }
+
+private:
+    void release_memory_if_above_high_water_mark() noexcept;
+
+    receive_buffer_config config;
+    std::shared_ptr<std::uint8_t[]> chunk = nullptr;
+    size_t chunk_capacity = 0;
+    size_t nr_bytes_used = 0;
+    size_t nr_bytes_consumed = 0;
+};
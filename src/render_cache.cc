@@ -0,0 +1,341 @@
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <format>
+#include <span>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "protocol.hh"
+#include "render_cache.hh"
+#include "utils.hh"
+
+namespace {
+    constexpr std::string_view cache_magic = "JGRCACHE";
+    constexpr size_t record_header_size = 4 + 4 + 8;
+
+    auto as_bytes(std::string_view data) noexcept -> std::span<const std::uint8_t> {
+        return std::span(reinterpret_cast<const std::uint8_t*>(data.data()), data.size());
+    }
+
+    auto record_hash(std::string_view key, std::string_view value) noexcept -> std::uint64_t {
+        return protocol::content_hash(as_bytes(value), protocol::content_hash(as_bytes(key)));
+    }
+
+    void append_record(std::string& dest, std::string_view key, std::string_view value) {
+        append_le(dest, static_cast<std::uint32_t>(key.size()));
+        append_le(dest, static_cast<std::uint32_t>(value.size()));
+        append_le(dest, record_hash(key, value));
+        dest += key;
+        dest += value;
+    }
+
+    auto write_string(int fd, std::string_view data) -> std::expected<void, std::string> {
+        return write_all(fd, as_bytes(data));
+    }
+
+    auto make_directory(const std::string& path) -> std::expected<void, std::string> {
+        if ((::mkdir(path.c_str(), 0700) != 0) && (errno != EEXIST)) {
+            return std::unexpected(std::format("can't create {}: {}", path, strerror(errno)));
+        }
+        return {};
+    }
+
+    struct record_view {
+        std::string_view key;
+        std::string_view value;
+        std::uint64_t hash;
+    };
+
+    // Indexes the records of content, the bytes of a cache file, the last record of a key
+    // winning. Returns the size of the valid part of the file.
+    auto index_records(std::string_view content, std::unordered_map<std::string_view, record_view>& records) -> size_t {
+        size_t pos = cache_magic.size();
+        while (content.size() - pos >= record_header_size) {
+            const auto key_size = load_le<std::uint32_t>(content.data() + pos);
+            const auto value_size = load_le<std::uint32_t>(content.data() + pos + 4);
+            const auto hash = load_le<std::uint64_t>(content.data() + pos + 8);
+            if (content.size() - pos - record_header_size < size_t{key_size} + value_size) {
+                break;
+            }
+            const auto key = content.substr(pos + record_header_size, key_size);
+            const auto value = content.substr(pos + record_header_size + key_size, value_size);
+            if (record_hash(key, value) != hash) {
+                break;
+            }
+            records.insert_or_assign(key, record_view{key, value, hash});
+            pos += record_header_size + key_size + value_size;
+        }
+        return pos;
+    }
+
+    auto newest_first(const std::unordered_map<std::string_view, record_view>& records) -> std::vector<record_view> {
+        std::vector<record_view> res;
+        res.reserve(records.size());
+        for (const auto& [key, record] : records) {
+            res.push_back(record);
+        }
+        // records point into the same mapping, so their address gives their order in the file
+        std::ranges::sort(res, [](const auto& a, const auto& b) noexcept { return a.value.data() > b.value.data(); });
+        return res;
+    }
+
+    // Replaces the file at path with the first records of newest_first, up to half of
+    // max_nr_bytes so that it isn't compacted again soon. Returns the number of records kept.
+    // The caller holds the lock of the file replaced.
+    auto write_compacted(const std::string& path, std::span<const record_view> newest_first,
+                         size_t max_nr_bytes) -> std::expected<size_t, std::string> {
+        size_t nr_bytes = cache_magic.size();
+        size_t nr_kept = 0;
+        for (const auto& record : newest_first) {
+            const auto record_size = record_header_size + record.key.size() + record.value.size();
+            if (nr_bytes + record_size > max_nr_bytes / 2) {
+                break;
+            }
+            nr_bytes += record_size;
+            ++nr_kept;
+        }
+
+        std::string content;
+        content.reserve(nr_bytes);
+        content += cache_magic;
+        for (size_t i = nr_kept; i > 0; --i) {
+            append_record(content, newest_first[i - 1].key, newest_first[i - 1].value);
+        }
+
+        const auto tmp_path = path + ".tmp";
+        const auto fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd == -1) {
+            return std::unexpected(std::format("can't create {}: {}", tmp_path, strerror(errno)));
+        }
+        auto written = write_string(fd, content);
+        ::close(fd);
+        if (written.has_value() && (::rename(tmp_path.c_str(), path.c_str()) != 0)) {
+            written = std::unexpected(std::format("can't replace {}: {}", path, strerror(errno)));
+        }
+        if (!written.has_value()) {
+            ::unlink(tmp_path.c_str());
+            return std::unexpected(std::move(written.error()));
+        }
+        return nr_kept;
+    }
+
+    // whether fd is still the file at path, and not one another instance replaced by compacting
+    auto is_file_at(int fd, const std::string& path) -> bool {
+        struct stat opened = {};
+        struct stat at_path = {};
+        return (::fstat(fd, &opened) == 0) && (::stat(path.c_str(), &at_path) == 0)
+            && (opened.st_dev == at_path.st_dev) && (opened.st_ino == at_path.st_ino);
+    }
+
+    // Opens the file at path and locks it. A file replaced while waiting for its lock is
+    // closed, and the new one is opened instead.
+    auto open_locked(const std::string& path) -> std::expected<int, std::string> {
+        while (true) {
+            const auto fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+            if (fd == -1) {
+                return std::unexpected(std::format("can't open {}: {}", path, strerror(errno)));
+            }
+            if (::flock(fd, LOCK_EX) != 0) {
+                const auto err = errno;
+                ::close(fd);
+                return std::unexpected(std::format("can't lock {}: {}", path, strerror(err)));
+            }
+            if (is_file_at(fd, path)) {
+                return fd;
+            }
+            ::close(fd);
+        }
+    }
+} // namespace
+
+auto render_cache::default_path() -> std::expected<std::string, std::string> {
+    std::string base;
+    if (const char* const cache_home = std::getenv("XDG_CACHE_HOME"); (cache_home != nullptr) && (cache_home[0] != '\0')) {
+        base = cache_home;
+    } else if (const char* const home = std::getenv("HOME"); home != nullptr) {
+        base = std::string(home) + "/.cache";
+    } else {
+        return std::unexpected(std::string("neither XDG_CACHE_HOME nor HOME is set"));
+    }
+    const auto dir = base + "/jira_gui";
+    for (const auto& path : {base, dir}) {
+        if (auto created = make_directory(path); !created.has_value()) {
+            return std::unexpected(std::move(created.error()));
+        }
+    }
+    return dir + "/render_cache";
+}
+
+auto render_cache::try_open(const std::string& path, size_t max_nr_bytes) -> std::expected<std::unique_ptr<render_cache>, std::string> {
+    // the second time, the file was just compacted
+    for (bool may_compact = true; ; may_compact = false) {
+        const auto opened = open_locked(path);
+        if (!opened.has_value()) {
+            return std::unexpected(opened.error());
+        }
+        const auto fd = opened.value();
+        const auto fail = [&](std::string_view what) {
+            const auto err = errno;
+            ::close(fd); // also releases the lock
+            return std::unexpected(std::format("{} {}: {}", what, path, strerror(err)));
+        };
+
+        struct stat file_stat = {};
+        if (::fstat(fd, &file_stat) != 0) {
+            return fail("can't get the size of");
+        }
+        auto size = static_cast<size_t>(file_stat.st_size);
+        std::array<char, cache_magic.size()> magic = {};
+        if ((size < cache_magic.size())
+            || (::pread(fd, magic.data(), magic.size(), 0) != static_cast<ssize_t>(magic.size()))
+            || (std::string_view(magic.data(), magic.size()) != cache_magic)) {
+            // new file, or not a cache
+            if ((::ftruncate(fd, 0) != 0) || !write_string(fd, cache_magic).has_value()) {
+                return fail("can't initialise");
+            }
+            size = cache_magic.size();
+        }
+
+        auto* const mapping = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED) {
+            return fail("can't map");
+        }
+        auto res = std::unique_ptr<render_cache>(new render_cache(path, fd, static_cast<const char*>(mapping), size, max_nr_bytes));
+        std::unordered_map<std::string_view, record_view> records;
+        const auto valid_size = index_records(std::string_view(res->mapping, size), records);
+        if (valid_size < size) {
+            // what follows was never fully written. Nothing of it is indexed, so the mapping isn't read there
+            [[maybe_unused]] const auto truncated = ::ftruncate(fd, static_cast<off_t>(valid_size));
+        }
+        res->values.reserve(records.size());
+        res->latest_hashes.reserve(records.size());
+        for (const auto& [key, record] : records) {
+            res->values.emplace(key, record.value);
+            res->latest_hashes.emplace(std::string(key), record.hash);
+        }
+
+        // only happens when the budget was lowered, store compacts the file before it gets there
+        if ((valid_size <= max_nr_bytes) || !may_compact) {
+            ::flock(fd, LOCK_UN);
+            return res;
+        }
+        if (auto compacted = write_compacted(path, newest_first(records), max_nr_bytes); !compacted.has_value()) {
+            // still usable as is
+            ::flock(fd, LOCK_UN);
+            return res;
+        }
+        // closing releases the lock, then the compacted file is opened
+    }
+}
+
+render_cache::render_cache(const std::string& file_path, int file_fd, const char* file_mapping, size_t file_mapping_size, size_t max_file_size)
+    : path(file_path)
+    , fd(file_fd)
+    , mapping(file_mapping)
+    , mapping_size(file_mapping_size)
+    , max_nr_bytes(max_file_size)
+{
+}
+
+render_cache::~render_cache() noexcept {
+    ::munmap(const_cast<char*>(mapping), mapping_size);
+    ::close(fd);
+}
+
+auto render_cache::find(std::string_view key) const -> std::optional<std::string_view> {
+    const auto it = values.find(key);
+    if (it == values.end()) {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+auto render_cache::lock_file() -> std::expected<void, std::string> {
+    if ((::flock(fd, LOCK_EX) == 0) && is_file_at(fd, path)) {
+        return {};
+    }
+    // another instance compacted the file. The mapping keeps the old one alive for find
+    auto opened = open_locked(path);
+    // the mapping also holds the file open, closing fd alone wouldn't release the lock
+    ::flock(fd, LOCK_UN);
+    if (!opened.has_value()) {
+        return std::unexpected(std::move(opened.error()));
+    }
+    ::close(fd);
+    fd = opened.value();
+    struct stat file_stat = {};
+    if ((::fstat(fd, &file_stat) == 0) && (file_stat.st_size == 0)) {
+        // the file was removed, and created again by opening it
+        return write_string(fd, cache_magic);
+    }
+    return {};
+}
+
+auto render_cache::compact_with(std::string_view key, std::string_view value, std::uint64_t hash, size_t file_size) -> std::expected<void, std::string> {
+    // other instances may have appended since the cache was opened, so the file is read again
+    auto* const current = ::mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (current == MAP_FAILED) {
+        return std::unexpected(std::format("can't map {}: {}", path, strerror(errno)));
+    }
+    std::unordered_map<std::string_view, record_view> current_records;
+    index_records(std::string_view(static_cast<const char*>(current), file_size), current_records);
+    current_records.erase(key);
+    auto kept = newest_first(current_records);
+    kept.insert(kept.begin(), record_view{key, value, hash});
+
+    const auto compacted = write_compacted(path, kept, max_nr_bytes);
+    if (compacted.has_value()) {
+        latest_hashes.clear();
+        for (const auto& record : std::span(kept).first(compacted.value())) {
+            latest_hashes.emplace(std::string(record.key), record.hash);
+        }
+    }
+    ::munmap(current, file_size);
+    if (!compacted.has_value()) {
+        return std::unexpected(compacted.error());
+    }
+    return {};
+}
+
+auto render_cache::store(std::string_view key, std::string_view value) -> std::expected<void, std::string> {
+    const auto hash = record_hash(key, value);
+    std::string record;
+    record.reserve(record_header_size + key.size() + value.size());
+    append_record(record, key, value);
+
+    const std::lock_guard lock(mutex);
+    auto [it, inserted] = latest_hashes.try_emplace(std::string(key), hash);
+    if (!inserted) {
+        if (it->second == hash) {
+            return {};
+        }
+        it->second = hash;
+    }
+    // O_APPEND puts the record at the end, the file lock keeps other instances from writing in between
+    if (auto locked = lock_file(); !locked.has_value()) {
+        latest_hashes.erase(std::string(key));
+        return locked;
+    }
+    struct stat file_stat = {};
+    std::expected<void, std::string> written;
+    if ((::fstat(fd, &file_stat) == 0) && (static_cast<size_t>(file_stat.st_size) + record.size() > max_nr_bytes)) {
+        // the file is replaced by its newest records, this one included when it fits
+        written = compact_with(key, value, hash, static_cast<size_t>(file_stat.st_size));
+    } else {
+        written = write_string(fd, record);
+    }
+    ::flock(fd, LOCK_UN);
+    if (!written.has_value()) {
+        // written again next time
+        latest_hashes.erase(std::string(key));
+    }
+    return written;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Cache on disk of what the window showed during previous runs, so that the next run can
+// paint it before the server answers. Keys and values are opaque bytes.
+//
+// The file is append-only: storing a value appends a record, and the last record of a key
+// wins. It starts with the 8 bytes "JGRCACHE", followed by records, integers being little
+// endian:
+//      u32         size of the key
+//      u32         size of the value
+//      u64         FNV-1a hash of the key then the value
+//      followed by the key bytes, then the value bytes
+// When opening, the file is mapped and scanned once to index the records. A record that
+// doesn't match its hash, typically the last one when the previous run died while writing
+// it, ends the file. When a record would make the file grow past its budget, the file is
+// replaced by one with only the newest value of each key, up to half the budget, older keys
+// being dropped first.
+//
+// Several instances of the application can use the same file: opening, appending and
+// compacting hold an exclusive lock on it. An instance whose file was replaced by another's
+// compaction opens the new file before appending.
+class render_cache final {
+public:
+    // $XDG_CACHE_HOME/jira_gui/render_cache, or ~/.cache/jira_gui/render_cache. The directories
+    // are created if needed.
+    static auto default_path() -> std::expected<std::string, std::string>;
+
+    static auto try_open(const std::string& path, size_t max_nr_bytes) -> std::expected<std::unique_ptr<render_cache>, std::string>;
+
+    render_cache(const render_cache&) = delete;
+    render_cache& operator=(const render_cache&) = delete;
+    ~render_cache() noexcept;
+
+    // Value of key when the cache was opened. It points into the mapping and stays valid as
+    // long as the cache. Thread safe.
+    auto find(std::string_view key) const -> std::optional<std::string_view>;
+
+    // Appends the value to the file, unless it is already the latest one of key. Compacts the
+    // file first when it would grow past its budget. Values stored are only found once the cache
+    // is opened again. Thread safe.
+    auto store(std::string_view key, std::string_view value) -> std::expected<void, std::string>;
+
+private:
+    render_cache(const std::string& file_path, int file_fd, const char* file_mapping, size_t file_mapping_size, size_t max_file_size);
+
+    // locks fd, after opening the file again if another instance replaced it
+    auto lock_file() -> std::expected<void, std::string>;
+    // Replaces the file, of file_size bytes, by its newest records, starting with the given
+    // one. fd must be locked.
+    auto compact_with(std::string_view key, std::string_view value, std::uint64_t hash, size_t file_size) -> std::expected<void, std::string>;
+
+    std::string path;
+    int fd;
+    const char* mapping;
+    size_t mapping_size;
+    size_t max_nr_bytes;
+    // both point into the mapping, and are read only once opened
+    std::unordered_map<std::string_view, std::string_view> values = {};
+    std::mutex mutex = {};
+    // hash of the latest record of each key, to skip storing the same value again
+    std::unordered_map<std::string, std::uint64_t> latest_hashes = {};
+};
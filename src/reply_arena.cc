@@ -0,0 +1,55 @@
+#include <algorithm>
+
+#include "reply_arena.hh"
+
+auto reply_arena::counting_upstream::do_allocate(size_t nr_bytes, size_t alignment) -> void* {
+    ++nr_blocks;
+    return std::pmr::new_delete_resource()->allocate(nr_bytes, alignment);
+}
+
+void reply_arena::counting_upstream::do_deallocate(void* ptr, size_t nr_bytes, size_t alignment) {
+    std::pmr::new_delete_resource()->deallocate(ptr, nr_bytes, alignment);
+}
+
+auto reply_arena::counting_upstream::do_is_equal(const std::pmr::memory_resource& other) const noexcept -> bool {
+    return this == &other;
+}
+
+reply_arena::reply_arena(size_t initial_size)
+    : monotonic(std::max(initial_size, size_t{1}), &upstream)
+{
+}
+
+reply_arena::reply_arena(std::span<std::byte> first_block)
+    : monotonic(first_block.data(), first_block.size(), &upstream)
+{
+}
+
+auto reply_arena::stats() const noexcept -> arena_stats {
+    return arena_stats{
+        .nr_allocations = nr_allocations,
+        .nr_bytes_allocated = nr_bytes_allocated,
+        .nr_blocks = upstream.nr_blocks,
+    };
+}
+
+void reply_arena::reset() noexcept {
+    monotonic.release();
+    upstream.nr_blocks = 0;
+    nr_allocations = 0;
+    nr_bytes_allocated = 0;
+}
+
+auto reply_arena::do_allocate(size_t nr_bytes, size_t alignment) -> void* {
+    ++nr_allocations;
+    nr_bytes_allocated += nr_bytes;
+    return monotonic.allocate(nr_bytes, alignment);
+}
+
+void reply_arena::do_deallocate(void* ptr, size_t nr_bytes, size_t alignment) {
+    monotonic.deallocate(ptr, nr_bytes, alignment);
+}
+
+auto reply_arena::do_is_equal(const std::pmr::memory_resource& other) const noexcept -> bool {
+    return this == &other;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+#include <span>
+
+struct arena_stats {
+    size_t nr_allocations = 0; // allocations served by the arena
+    size_t nr_bytes_allocated = 0; // total size of those allocations
+    size_t nr_blocks = 0; // blocks the arena got from the heap to serve them
+};
+
+// Monotonic memory resource used while decoding one reply. Everything decoding allocates
+// (strings, vectors, ...) comes out of a few big blocks which are given back all at once
+// when the arena is destroyed, instead of one heap allocation and one free per object.
+// Memory given back to the arena before that is not reused.
+// Not thread safe: each reply is decoded by a single thread.
+class reply_arena final : public std::pmr::memory_resource {
+public:
+    // initial_size is the size of the first block. Following blocks grow geometrically.
+    explicit reply_arena(size_t initial_size);
+    // The first block is first_block, which must outlive the arena. reset goes back to it, so an
+    // arena decoding one reply after the other only uses the heap for the replies not fitting in it.
+    explicit reply_arena(std::span<std::byte> first_block);
+    reply_arena(const reply_arena&) = delete;
+    reply_arena& operator=(const reply_arena&) = delete;
+    ~reply_arena() override = default;
+
+    auto stats() const noexcept -> arena_stats;
+    // gives back everything allocated so far, and resets the stats
+    void reset() noexcept;
+
+private:
+    // counts the blocks the monotonic resource gets from the heap
+    class counting_upstream final : public std::pmr::memory_resource {
+    public:
+        size_t nr_blocks = 0;
+
+    private:
+        auto do_allocate(size_t nr_bytes, size_t alignment) -> void* override;
+        void do_deallocate(void* ptr, size_t nr_bytes, size_t alignment) override;
+        auto do_is_equal(const std::pmr::memory_resource& other) const noexcept -> bool override;
+    };
+
+    auto do_allocate(size_t nr_bytes, size_t alignment) -> void* override;
+    void do_deallocate(void* ptr, size_t nr_bytes, size_t alignment) override;
+    auto do_is_equal(const std::pmr::memory_resource& other) const noexcept -> bool override;
+
+    // declared first: the monotonic resource gives its blocks back to it when destroyed
+    counting_upstream upstream = {};
+    std::pmr::monotonic_buffer_resource monotonic;
+    size_t nr_allocations = 0;
+    size_t nr_bytes_allocated = 0;
+};
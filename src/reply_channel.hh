@@ -0,0 +1,52 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+
+#include "wake_up_event.hh"
+
+// Channel passing messages from a background thread to the UI thread.
+// The producer pushes messages one by one, but the wake up fd is only signalled when
+// the channel goes from empty to non empty. The consumer, woken up by a QSocketNotifier
+// on that fd, then takes every message queued so far in one go. A burst of replies
+// therefore costs a single trip through the event loop instead of one per message.
+template <typename T>
+class reply_channel final {
+public:
+    reply_channel() = default;
+    reply_channel(const reply_channel&) = delete;
+    reply_channel& operator=(const reply_channel&) = delete;
+
+    void push(T msg) {
+        bool was_empty;
+        {
+            const std::lock_guard lock(mutex);
+            was_empty = queued.empty();
+            queued.emplace_back(std::move(msg));
+        }
+        if (was_empty) {
+            wake_up.signal();
+        }
+    }
+
+    // returns all messages pushed since the last call, in the order they were pushed
+    auto take_all() -> std::vector<T> {
+        // cleared before taking the messages. A message pushed after the swap below
+        // finds the queue empty and signals again.
+        wake_up.clear();
+        std::vector<T> res;
+        {
+            const std::lock_guard lock(mutex);
+            std::swap(res, queued);
+        }
+        return res;
+    }
+
+    auto get_wake_up_fd() const noexcept -> int { return wake_up.get_fd(); }
+    auto is_valid() const noexcept -> bool { return wake_up.is_valid(); }
+
+private:
+    std::mutex mutex = {};
+    std::vector<T> queued = {};
+    wake_up_event wake_up = {};
+};
@@ -0,0 +1,178 @@
+#include <algorithm>
+
+#include "reply_framing.hh"
+#include "utils.hh"
+
+namespace {
+    auto kind_from_word(std::string_view word) -> std::optional<reply_kind> {
+        if (word == "ACK") {
+            return reply_kind::ack;
+        }
+        if (word == "RESULT") {
+            return reply_kind::result;
+        }
+        if (word == "ERROR") {
+            return reply_kind::error;
+        }
+        if (word == "FINISHED") {
+            return reply_kind::finished;
+        }
+        if (word == "NOT_MODIFIED") {
+            return reply_kind::not_modified;
+        }
+        return std::nullopt;
+    }
+}
+
+auto parse_line_message(const byte_slice& line_slice) -> std::optional<server_message> {
+    auto line = line_slice.as_string_view();
+    if (line.ends_with('\n')) {
+        line.remove_suffix(1);
+    }
+
+    const auto id_end = line.find(' ');
+    if ((id_end == std::string_view::npos) || (id_end == 0)) {
+        return std::nullopt;
+    }
+    const auto request_id = line.substr(0, id_end);
+    const auto after_id = line.substr(id_end + 1);
+
+    // the payload is optional, e.g. "<id> RESULT\n" is an empty result
+    const auto kind_end = after_id.find(' ');
+    const auto kind_word = after_id.substr(0, kind_end);
+    const auto kind = kind_from_word(kind_word);
+    if (!kind.has_value()) {
+        return std::nullopt;
+    }
+
+    auto payload = byte_slice{};
+    if (kind_end != std::string_view::npos) {
+        const auto payload_offset = id_end + 1 + kind_end + 1;
+        payload = line_slice.subslice(payload_offset, line.size() - payload_offset);
+    }
+
+    return server_message{
+        .request_id = std::string(request_id),
+        .kind = kind.value(),
+        .encoding = payload_encoding::base64_text,
+        .payload = std::move(payload),
+    };
+}
+
+auto parse_frame_header(const std::uint8_t* data) -> std::optional<frame_header> {
+    if ((data[0] != static_cast<std::uint8_t>(frame_header::magic[0]))
+        || (data[1] != static_cast<std::uint8_t>(frame_header::magic[1]))
+        || (data[2] != frame_header::version)) {
+        return std::nullopt;
+    }
+
+    const auto is_bulk = (data[3] & frame_header::bulk_flag) != 0;
+    const auto kind_byte = static_cast<std::uint8_t>(data[3] & ~frame_header::bulk_flag);
+    if ((kind_byte < static_cast<std::uint8_t>(reply_kind::ack))
+        || (kind_byte > static_cast<std::uint8_t>(reply_kind::not_modified))) {
+        return std::nullopt;
+    }
+
+    const auto request_id_size = load_le<std::uint32_t>(data + 4);
+    if ((request_id_size == 0) || (request_id_size > frame_header::max_request_id_size)) {
+        return std::nullopt;
+    }
+
+    const auto payload_size = load_le<std::uint64_t>(data + 8);
+    if ((payload_size > frame_header::max_payload_size)
+        || (is_bulk && (payload_size != bulk_descriptor::wire_size))) {
+        return std::nullopt;
+    }
+
+    return frame_header{
+        .kind = static_cast<reply_kind>(kind_byte),
+        .is_bulk = is_bulk,
+        .request_id_size = request_id_size,
+        .payload_size = payload_size,
+    };
+}
+
+auto parse_bulk_descriptor(const byte_slice& payload) -> std::optional<bulk_descriptor> {
+    if (payload.size() != bulk_descriptor::wire_size) {
+        return std::nullopt;
+    }
+    return bulk_descriptor{
+        .position = load_le<std::uint64_t>(payload.data()),
+        .size = load_le<std::uint64_t>(payload.data() + 8),
+    };
+}
+
+pair_reader::pair_reader(std::string_view data, payload_encoding data_encoding) noexcept
+    : payload(data)
+    , encoding(data_encoding)
+{
+}
+
+auto pair_reader::next() noexcept -> std::optional<kv_view> {
+    if (payload.empty() || malformed) {
+        return std::nullopt;
+    }
+    return (encoding == payload_encoding::base64_text) ? next_text_pair() : next_framed_pair();
+}
+
+auto pair_reader::next_text_pair() noexcept -> std::optional<kv_view> {
+    const auto comma_pos = payload.find(',');
+    const auto kv = payload.substr(0, comma_pos);
+    const auto colon_pos = kv.find(':');
+    if (colon_pos == std::string_view::npos) {
+        malformed = true;
+        return std::nullopt;
+    }
+    // like std::getline, a trailing separator doesn't start a new empty element
+    payload.remove_prefix((comma_pos == std::string_view::npos) ? payload.size() : comma_pos + 1);
+    return kv_view{ .key = kv.substr(0, colon_pos), .value = kv.substr(colon_pos + 1) };
+}
+
+auto pair_reader::next_framed_pair() noexcept -> std::optional<kv_view> {
+    auto rest = payload;
+    const auto read_field = [&]() -> std::optional<std::string_view> {
+        if (rest.size() < sizeof(std::uint32_t)) {
+            return std::nullopt;
+        }
+        const auto field_size = load_le<std::uint32_t>(rest.data());
+        rest.remove_prefix(sizeof(std::uint32_t));
+        if (rest.size() < field_size) {
+            return std::nullopt;
+        }
+        const auto res = rest.substr(0, field_size);
+        rest.remove_prefix(field_size);
+        return res;
+    };
+
+    const auto key = read_field();
+    const auto value = read_field();
+    if ((!key.has_value()) || (!value.has_value())) {
+        malformed = true;
+        return std::nullopt;
+    }
+    payload = rest;
+    return kv_view{ .key = key.value(), .value = value.value() };
+}
+
+auto pair_reader::count_hint() const noexcept -> size_t {
+    if (payload.empty()) {
+        return 0;
+    }
+    if (encoding == payload_encoding::base64_text) {
+        // find goes through memchr, which is much faster than std::count on long payloads
+        size_t nr_commas = 0;
+        for (auto pos = payload.find(','); pos != std::string_view::npos; pos = payload.find(',', pos + 1)) {
+            ++nr_commas;
+        }
+        return nr_commas + 1;
+    }
+    // hops over the fields without looking at their content
+    size_t nr_fields = 0;
+    auto rest = payload;
+    while (rest.size() >= sizeof(std::uint32_t)) {
+        const auto field_size = load_le<std::uint32_t>(rest.data());
+        rest.remove_prefix(std::min(rest.size(), sizeof(std::uint32_t) + size_t{field_size}));
+        ++nr_fields;
+    }
+    return nr_fields / 2;
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "receive_buffer.hh"
+
+// Replies from local_jira come in one of two wire formats:
+//
+// - text lines (the historical format, always available):
+//      <request id> <KIND>[ <payload>]\n
+//   where binary data inside the payload is base64 encoded.
+//
+// - binary frames, used once the server acknowledged a "SET_REPLY_FORMAT BINARY_FRAMES"
+//   request. Every frame starts with a fixed size header, all integers being little endian:
+//      offset 0: 'J' 'F'   magic
+//      offset 2: u8        version (currently 1)
+//      offset 3: u8        kind (see reply_kind), bit 7 set for bulk frames (see below)
+//      offset 4: u32       size of the request id
+//      offset 8: u64       size of the payload
+//   followed by the request id bytes, then the payload bytes.
+//   Payloads are not base64 encoded. Lists of pairs (key/value properties of a ticket,
+//   uuid/filename of attachments) are encoded as a sequence of fields, each field being
+//   a u32 size followed by that many bytes, alternating key and value.
+//
+//   When a bulk channel was negotiated (see bulk_channel.hh), big payloads don't go through
+//   the pipe. The server writes them in the shared ring, and sends a bulk frame whose payload
+//   is a 16 bytes descriptor instead:
+//      offset 0: u64       position of the payload in the ring
+//      offset 8: u64       size of the payload
+//
+// Requests sent to the server always use the text format.
+
+enum class reply_kind : std::uint8_t {
+    ack = 1,
+    result = 2,
+    error = 3,
+    finished = 4,
+    not_modified = 5, // only replies to FETCH_TICKET_IF_MODIFIED, instead of RESULT
+};
+
+enum class payload_encoding : std::uint8_t {
+    base64_text, // message came from a text line, binary data is base64 encoded
+    raw_bytes,   // message came from a binary frame, data is as is
+};
+
+enum class wire_format : std::uint8_t {
+    text_lines,
+    binary_frames,
+};
+
+struct server_message {
+    std::string request_id;
+    reply_kind kind;
+    payload_encoding encoding;
+    byte_slice payload; // for text lines, doesn't contain the trailing '\n'
+};
+
+struct frame_header {
+    static constexpr size_t wire_size = 16;
+    static constexpr std::array<char, 2> magic = {'J', 'F'};
+    static constexpr std::uint8_t version = 1;
+    static constexpr std::uint8_t bulk_flag = 0x80;
+    // protect against allocating gigabytes because of a corrupted stream
+    static constexpr std::uint32_t max_request_id_size = 4096;
+    static constexpr std::uint64_t max_payload_size = std::uint64_t{4} * 1024 * 1024 * 1024;
+
+    reply_kind kind;
+    bool is_bulk; // the payload is a bulk_descriptor
+    std::uint32_t request_id_size;
+    std::uint64_t payload_size;
+};
+
+struct bulk_descriptor {
+    static constexpr size_t wire_size = 16;
+
+    std::uint64_t position;
+    std::uint64_t size;
+};
+
+// Request id used by the prog handler to ask the server to switch to binary frames.
+// Replies to it are handled by the prog handler itself and never forwarded.
+inline constexpr std::string_view reply_format_request_id = "reply-format-negotiation";
+
+// Request id used by the prog handler to give the bulk channel to the server. Replies to it
+// are dropped: the server sends bulk frames only if it accepted the channel.
+inline constexpr std::string_view bulk_channel_request_id = "bulk-channel-negotiation";
+
+// Request id of priority hints. It doesn't end with a request number, so replies to it are dropped.
+inline constexpr std::string_view priority_hint_request_id = "priority-hint";
+
+// the payload of the returned message shares the line's storage
+auto parse_line_message(const byte_slice& line) -> std::optional<server_message>;
+auto parse_frame_header(const std::uint8_t* data) -> std::optional<frame_header>;
+auto parse_bulk_descriptor(const byte_slice& payload) -> std::optional<bulk_descriptor>;
+
+struct kv_pair { // could use std::pair, but nicer to have names
+    std::pmr::string key;
+    std::pmr::string value;
+
+    kv_pair(std::pmr::string k, std::pmr::string v) noexcept
+            : key(std::move(k))
+            , value(std::move(v))
+    {
+    }
+};
+
+// views into a payload holding a list of pairs
+struct kv_view {
+    std::string_view key;
+    std::string_view value;
+};
+
+// Single pass reader over the list of pairs of a payload, in either wire format:
+// "key1:value1,key2:value2,..." for text lines, size-prefixed fields for binary frames.
+// Pairs are returned as views into the payload, nothing is copied or decoded.
+class pair_reader final {
+public:
+    pair_reader(std::string_view payload, payload_encoding encoding) noexcept;
+
+    // returns std::nullopt once all pairs were read, or at the first malformed one
+    auto next() noexcept -> std::optional<kv_view>;
+    auto is_malformed() const noexcept -> bool { return malformed; }
+    // part of the payload not read yet. After an error, starts at the malformed pair
+    auto remaining() const noexcept -> std::string_view { return payload; }
+    // number of pairs left, assuming the payload is well formed. Cheap, meant to reserve memory
+    auto count_hint() const noexcept -> size_t;
+
+private:
+    auto next_text_pair() noexcept -> std::optional<kv_view>;
+    auto next_framed_pair() noexcept -> std::optional<kv_view>;
+
+    std::string_view payload;
+    payload_encoding encoding;
+    bool malformed = false;
+};
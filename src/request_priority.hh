@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+// Scheduling class of a request. The writer thread sends queued requests in this order, and
+// the server is told about it so that it can schedule its work the same way: the ticket the
+// user looks at comes back first, even while a full reset or a batch download is in flight.
+enum class request_priority : std::uint8_t {
+    interactive, // the user is waiting for it, e.g. the ticket just clicked
+    background,  // the user asked for it but doesn't watch it, e.g. synchronising projects
+    bulk,        // big transfers, e.g. attachment downloads
+};
+
+constexpr auto to_wire_name(request_priority priority) noexcept -> std::string_view {
+    switch (priority) {
+        case request_priority::interactive:
+            return "INTERACTIVE";
+        case request_priority::background:
+            return "BACKGROUND";
+        case request_priority::bulk:
+            return "BULK";
+        default:
+            return "INTERACTIVE";
+    }
+}
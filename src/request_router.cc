@@ -0,0 +1,61 @@
+#include <charconv>
+
+#include "request_router.hh"
+
+auto parse_request_number(std::string_view request_id) -> std::optional<std::uint64_t> {
+    const auto dash_pos = request_id.rfind('-');
+    if ((dash_pos == std::string_view::npos) || (dash_pos + 1 == request_id.size())) {
+        return std::nullopt;
+    }
+    const auto* const begin = request_id.data() + dash_pos + 1;
+    const auto* const end = request_id.data() + request_id.size();
+
+    std::uint64_t res;
+    const auto [ptr, err] = std::from_chars(begin, end, res);
+    if ((err != std::errc{}) || (ptr != end)) {
+        return std::nullopt;
+    }
+    return res;
+}
+
+void request_router::add(std::uint64_t request_number, reply_handler on_reply, failure_handler on_failure) {
+    pending.insert_or_assign(request_number, pending_request{
+        .on_reply = std::make_shared<const reply_handler>(std::move(on_reply)),
+        .on_failure = std::make_shared<const failure_handler>(std::move(on_failure)),
+    });
+}
+
+auto request_router::dispatch(decoded_reply& reply) -> bool {
+    const auto& msg = reply.msg;
+    const auto request_number = parse_request_number(msg.request_id);
+    if (!request_number.has_value()) {
+        return false;
+    }
+    const auto it = pending.find(request_number.value());
+    if (it == pending.end()) {
+        return false;
+    }
+
+    const auto handler = it->second.on_reply;
+    if (msg.kind == reply_kind::finished) {
+        // erased before calling the handler, which may register new requests
+        pending.erase(it);
+    }
+    (*handler)(reply);
+    return true;
+}
+
+auto request_router::fail(std::uint64_t request_number, const std::string& reason) -> bool {
+    const auto it = pending.find(request_number);
+    if (it == pending.end()) {
+        return false;
+    }
+    const auto handler = it->second.on_failure;
+    pending.erase(it);
+    (*handler)(reason);
+    return true;
+}
+
+void request_router::forget(std::uint64_t request_number) {
+    pending.erase(request_number);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "decode_pipeline.hh"
+#include "reply_framing.hh"
+
+// Request ids sent to the server end with "-<number>", the number being unique for the
+// lifetime of the program. E.g. "PRJ-1234-fetch-html-42". Only the number is used to find
+// who is waiting for a reply, the rest is there to make the protocol readable in traces.
+auto parse_request_number(std::string_view request_id) -> std::optional<std::uint64_t>;
+
+// Keeps track of the requests sent to the server and calls the handlers registered for them
+// when replies come back. Any number of requests can be in flight at the same time, and
+// finding the handler of a reply is a single hash table lookup.
+// Not thread safe: meant to be used from the UI thread only.
+class request_router final {
+public:
+    using reply_handler = std::function<void(decoded_reply& reply)>;
+    using failure_handler = std::function<void(const std::string& reason)>;
+
+    // the handlers are dropped after the FINISHED reply, or after a failure.
+    void add(std::uint64_t request_number, reply_handler on_reply, failure_handler on_failure);
+
+    // Calls the reply handler of the request reply answers. Returns false if there is none,
+    // e.g. for replies to requests that were forgotten.
+    auto dispatch(decoded_reply& reply) -> bool;
+
+    // Calls the failure handler of the request, if any, and forgets about the request
+    auto fail(std::uint64_t request_number, const std::string& reason) -> bool;
+
+    // Replies to this request will be ignored from now on
+    void forget(std::uint64_t request_number);
+
+    auto nr_pending_requests() const noexcept -> size_t { return pending.size(); }
+
+private:
+    struct pending_request {
+        // shared so that a handler stays alive while it runs, even if it causes its
+        // own request to be forgotten
+        std::shared_ptr<const reply_handler> on_reply;
+        std::shared_ptr<const failure_handler> on_failure;
+    };
+
+    std::unordered_map<std::uint64_t, pending_request> pending = {};
+};
@@ -0,0 +1,211 @@
+#include <cerrno>
+#include <cstring>
+#include <format>
+#include <span>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "session_trace.hh"
+#include "utils.hh"
+
+namespace {
+    constexpr std::string_view trace_magic = "JGTRACE1";
+    constexpr std::uint8_t request_record = 1;
+    constexpr std::uint8_t reply_record = 2;
+    // the buffer is written to the file once it holds that much
+    constexpr size_t flush_size = size_t{1024} * 1024;
+
+    // reads integers and byte ranges one after the other, failing once past the end
+    class trace_cursor {
+    public:
+        explicit trace_cursor(const byte_slice& trace_data)
+            : data(trace_data)
+        {
+        }
+
+        auto at_end() const noexcept -> bool { return pos == data.size(); }
+        auto position() const noexcept -> size_t { return pos; }
+
+        template <typename T>
+        auto read() -> std::optional<T> {
+            if (data.size() - pos < sizeof(T)) {
+                return std::nullopt;
+            }
+            const auto res = load_le<T>(data.data() + pos);
+            pos += sizeof(T);
+            return res;
+        }
+
+        auto read_bytes(size_t nr_bytes) -> std::optional<byte_slice> {
+            if (data.size() - pos < nr_bytes) {
+                return std::nullopt;
+            }
+            auto res = data.subslice(pos, nr_bytes);
+            pos += nr_bytes;
+            return res;
+        }
+
+    private:
+        const byte_slice& data;
+        size_t pos = 0;
+    };
+
+    auto read_file(const std::string& path) -> std::expected<byte_slice, std::string> {
+        const auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            return std::unexpected(std::format("can't open {}: {}", path, strerror(errno)));
+        }
+        struct stat file_stat = {};
+        if (fstat(fd, &file_stat) != 0) {
+            const auto err = errno;
+            ::close(fd);
+            return std::unexpected(std::format("can't get the size of {}: {}", path, strerror(err)));
+        }
+        const auto size = static_cast<size_t>(file_stat.st_size);
+        auto content = std::make_shared_for_overwrite<std::uint8_t[]>(size);
+        size_t nr_read = 0;
+        while (nr_read < size) {
+            const auto ret = ::read(fd, content.get() + nr_read, size - nr_read);
+            if (ret == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                const auto err = errno;
+                ::close(fd);
+                return std::unexpected(std::format("can't read {}: {}", path, strerror(err)));
+            }
+            if (ret == 0) {
+                break;
+            }
+            nr_read += static_cast<size_t>(ret);
+        }
+        ::close(fd);
+        auto* const data = content.get();
+        return byte_slice(std::move(content), data, nr_read);
+    }
+} // namespace
+
+auto read_session_trace(const std::string& path) -> std::expected<session_trace, std::string> {
+    auto content = read_file(path);
+    if (!content.has_value()) {
+        return std::unexpected(std::move(content.error()));
+    }
+    auto res = session_trace{ .requests = {}, .replies = {}, .storage = std::move(content.value()) };
+    if (!res.storage.as_string_view().starts_with(trace_magic)) {
+        return std::unexpected(std::format("{} isn't a session trace", path));
+    }
+
+    trace_cursor cursor(res.storage);
+    cursor.read_bytes(trace_magic.size());
+    while (!cursor.at_end()) {
+        const auto record_start = cursor.position();
+        const auto truncated = [&]() {
+            return std::unexpected(std::format("truncated record at offset {} of {}", record_start, path));
+        };
+        const auto type = cursor.read<std::uint8_t>();
+        const auto time = cursor.read<std::uint64_t>();
+        if (!type.has_value() || !time.has_value()) {
+            return truncated();
+        }
+        const auto timestamp = std::chrono::nanoseconds{static_cast<std::chrono::nanoseconds::rep>(time.value())};
+
+        if (type.value() == request_record) {
+            const auto size = cursor.read<std::uint32_t>();
+            const auto request = size.has_value() ? cursor.read_bytes(size.value()) : std::nullopt;
+            if (!request.has_value()) {
+                return truncated();
+            }
+            res.requests.push_back({ .time = timestamp, .request = request->as_string_view() });
+        } else if (type.value() == reply_record) {
+            const auto kind = cursor.read<std::uint8_t>();
+            const auto encoding = cursor.read<std::uint8_t>();
+            const auto id_size = cursor.read<std::uint32_t>();
+            const auto payload_size = cursor.read<std::uint64_t>();
+            if (!kind.has_value() || !encoding.has_value() || !id_size.has_value() || !payload_size.has_value()) {
+                return truncated();
+            }
+            const auto request_id = cursor.read_bytes(id_size.value());
+            auto payload = cursor.read_bytes(payload_size.value());
+            if (!request_id.has_value() || !payload.has_value()) {
+                return truncated();
+            }
+            if ((kind.value() < static_cast<std::uint8_t>(reply_kind::ack)) || (kind.value() > static_cast<std::uint8_t>(reply_kind::not_modified))
+                || (encoding.value() > static_cast<std::uint8_t>(payload_encoding::raw_bytes))) {
+                return std::unexpected(std::format("invalid reply at offset {} of {}", record_start, path));
+            }
+            res.replies.push_back({
+                .time = timestamp,
+                .msg = server_message{
+                    .request_id = std::string(request_id->as_string_view()),
+                    .kind = static_cast<reply_kind>(kind.value()),
+                    .encoding = static_cast<payload_encoding>(encoding.value()),
+                    .payload = std::move(payload.value()),
+                },
+            });
+        } else {
+            return std::unexpected(std::format("unknown record type {} at offset {} of {}", type.value(), record_start, path));
+        }
+    }
+    return res;
+}
+
+auto session_recorder::try_new(const std::string& path) -> std::expected<std::shared_ptr<session_recorder>, std::string> {
+    const auto fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        return std::unexpected(std::format("can't create {}: {}", path, strerror(errno)));
+    }
+    auto res = std::shared_ptr<session_recorder>(new session_recorder(fd));
+    res->buffer += trace_magic;
+    return res;
+}
+
+session_recorder::session_recorder(int trace_fd) noexcept
+    : fd(trace_fd)
+{
+}
+
+session_recorder::~session_recorder() noexcept {
+    if (!failed) {
+        [[maybe_unused]] const auto written = write_all(fd, std::span(reinterpret_cast<const std::uint8_t*>(buffer.data()), buffer.size()));
+    }
+    ::close(fd);
+}
+
+void session_recorder::record_request(std::string_view request) {
+    const std::lock_guard lock(mutex);
+    append_header(request_record);
+    append_le(buffer, static_cast<std::uint32_t>(request.size()));
+    buffer += request;
+    flush_if_full();
+}
+
+void session_recorder::record_reply(const server_message& msg) {
+    const std::lock_guard lock(mutex);
+    append_header(reply_record);
+    append_le(buffer, static_cast<std::uint8_t>(msg.kind));
+    append_le(buffer, static_cast<std::uint8_t>(msg.encoding));
+    append_le(buffer, static_cast<std::uint32_t>(msg.request_id.size()));
+    append_le<std::uint64_t>(buffer, msg.payload.size());
+    buffer += msg.request_id;
+    buffer += msg.payload.as_string_view();
+    flush_if_full();
+}
+
+void session_recorder::append_header(std::uint8_t record_type) {
+    const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    append_le(buffer, record_type);
+    append_le(buffer, static_cast<std::uint64_t>(elapsed.count()));
+}
+
+void session_recorder::flush_if_full() {
+    if ((buffer.size() < flush_size) || failed) {
+        return;
+    }
+    const auto written = write_all(fd, std::span(reinterpret_cast<const std::uint8_t*>(buffer.data()), buffer.size()));
+    if (!written.has_value()) {
+        failed = true;
+    }
+    buffer.clear();
+}
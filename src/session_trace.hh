@@ -0,0 +1,77 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "receive_buffer.hh"
+#include "reply_framing.hh"
+
+// Trace of the traffic between the client and the server, to replay a session offline.
+// The file starts with the 8 bytes "JGTRACE1", followed by records, integers being little endian:
+//      u8          record type: 1 for a request, 2 for a reply
+//      u64         nanoseconds since the recording started
+//   requests:
+//      u32         size of the request, then the request as sent, '\n' included
+//   replies:
+//      u8          reply kind (see reply_kind)
+//      u8          payload encoding (see payload_encoding)
+//      u32         size of the request id
+//      u64         size of the payload
+//      followed by the request id bytes, then the payload bytes
+// Replies are recorded once read, with payloads of the bulk channel inlined. The negotiation
+// of the wire format and of the bulk channel isn't recorded.
+
+struct trace_request {
+    std::chrono::nanoseconds time;
+    std::string_view request; // points into the trace
+};
+
+struct trace_reply {
+    std::chrono::nanoseconds time;
+    server_message msg; // shares the trace's storage
+};
+
+struct session_trace {
+    // in the order they were recorded
+    std::vector<trace_request> requests;
+    std::vector<trace_reply> replies;
+    byte_slice storage; // the whole file
+};
+
+auto read_session_trace(const std::string& path) -> std::expected<session_trace, std::string>;
+
+// Writes a trace while the session goes. Thread safe: requests are recorded by the thread
+// writing them to the server, replies by the thread reading them.
+// Records are buffered, and written to the file in big chunks.
+class session_recorder final {
+public:
+    static auto try_new(const std::string& path) -> std::expected<std::shared_ptr<session_recorder>, std::string>;
+
+    session_recorder(const session_recorder&) = delete;
+    session_recorder& operator=(const session_recorder&) = delete;
+    // flushes what is still buffered
+    ~session_recorder() noexcept;
+
+    void record_request(std::string_view request);
+    void record_reply(const server_message& msg);
+
+private:
+    explicit session_recorder(int trace_fd) noexcept;
+
+    // mutex must be held
+    void append_header(std::uint8_t record_type);
+    void flush_if_full();
+
+    int fd;
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::mutex mutex = {};
+    std::string buffer = {};
+    bool failed = false; // nothing is written after an error, the trace would be corrupted
+};
@@ -0,0 +1,45 @@
+#include <mutex>
+
+#include "string_table.hh"
+
+namespace {
+    auto size_in_table(std::string_view text, const QString& converted) -> size_t {
+        return text.size() + static_cast<size_t>(converted.size()) * sizeof(QChar);
+    }
+} // namespace
+
+auto string_table::intern(std::string_view text) -> interned_string {
+    {
+        std::shared_lock lock(mutex);
+        if (const auto it = ids.find(text); it != ids.end()) {
+            const auto id = it->second;
+            nr_lookups.fetch_add(1, std::memory_order_relaxed);
+            nr_bytes_saved.fetch_add(size_in_table(text, strings[id]), std::memory_order_relaxed);
+            return { .id = id, .text = strings[id] };
+        }
+    }
+
+    // converted outside the lock, another thread may intern the same text meanwhile
+    auto converted = QString::fromUtf8(text.data(), static_cast<qsizetype>(text.size()));
+
+    std::unique_lock lock(mutex);
+    nr_lookups.fetch_add(1, std::memory_order_relaxed);
+    const auto [it, is_new] = ids.try_emplace(std::string(text), static_cast<std::uint32_t>(strings.size()));
+    if (is_new) {
+        nr_bytes_held += size_in_table(text, converted);
+        strings.push_back(std::move(converted));
+    } else {
+        nr_bytes_saved.fetch_add(size_in_table(text, converted), std::memory_order_relaxed);
+    }
+    return { .id = it->second, .text = strings[it->second] };
+}
+
+auto string_table::stats() const -> string_table_stats {
+    std::shared_lock lock(mutex);
+    return {
+        .nr_strings = strings.size(),
+        .nr_bytes_held = nr_bytes_held,
+        .nr_lookups = nr_lookups.load(std::memory_order_relaxed),
+        .nr_bytes_saved = nr_bytes_saved.load(std::memory_order_relaxed),
+    };
+}
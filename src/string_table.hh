@@ -0,0 +1,51 @@
+#pragma once
+
+#include <QString>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+struct interned_string {
+    // same id means same text, within one string_table
+    std::uint32_t id = 0;
+    // shares its characters with the table and every other copy of the same string
+    QString text = {};
+};
+
+struct string_table_stats {
+    size_t nr_strings = 0; // distinct strings held
+    size_t nr_bytes_held = 0; // utf-8 and utf-16 copies of them, excluding the lookup structures
+    size_t nr_lookups = 0; // calls to intern
+    size_t nr_bytes_saved = 0; // bytes the lookups returning an existing string didn't allocate
+};
+
+// Strings shared by all the tickets: property names, status names, user names, ...
+// Each distinct string is converted to a QString once and stored once, later lookups of the
+// same text get a copy sharing that storage, and an id to compare against instead of the text.
+// Strings are never removed, so the table only suits strings drawn from a small set.
+// Thread safe: decode workers intern concurrently.
+class string_table {
+public:
+    auto intern(std::string_view text) -> interned_string;
+    auto stats() const -> string_table_stats;
+
+private:
+    struct string_hash {
+        using is_transparent = void;
+        auto operator()(std::string_view s) const noexcept -> size_t { return std::hash<std::string_view>{}(s); }
+    };
+
+    mutable std::shared_mutex mutex;
+    std::unordered_map<std::string, std::uint32_t, string_hash, std::equal_to<>> ids;
+    std::vector<QString> strings; // indexed by id
+    size_t nr_bytes_held = 0;
+    // updated by lookups holding only the shared lock
+    std::atomic<size_t> nr_lookups = 0;
+    std::atomic<size_t> nr_bytes_saved = 0;
+};
@@ -1,125 +1,354 @@
 #include <algorithm>
+#include <array>
 #include <cstdint>
 #include <vector>
 #include <stdexcept>
 #include <format>
+#include <cerrno>
+#include <cstring>
+
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 #include "utils.hh"
 
-bool is_issue_before(const std::string& a, const std::string& b) {
-    bool is_before;
-    const auto a_dash = std::find(a.cbegin(), a.cend(), '-');
-    const auto b_dash = std::find(b.cbegin(), b.cend(), '-');
-    if ((a_dash == a.cend()) || (b_dash == b.cend())
-        || (std::string(a.cbegin(), a_dash) != std::string(b.cbegin(), b_dash))) {
-        is_before = a < b;
-    } else {
-        try {
-            const auto num_a = std::stol(std::string(std::next(a_dash), a.cend()));
-            const auto num_b = std::stol(std::string(std::next(b_dash), b.cend()));
-            is_before = num_a < num_b;
-        } catch (...) {
-            is_before = a < b;
-        }
-    }
-    return is_before;
+namespace {
+    constexpr std::uint8_t invalid_base64_char = 0xFF;
+
+    constexpr auto make_base64_decoding_table() -> std::array<std::uint8_t, 256> {
+        std::array<std::uint8_t, 256> table = {};
+        table.fill(invalid_base64_char);
+        constexpr std::string_view alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        for (size_t i = 0; i < alphabet.size(); ++i) {
+            table[static_cast<unsigned char>(alphabet[i])] = static_cast<std::uint8_t>(i);
+        }
+        return table;
+    }
+
+    constexpr auto base64_decoding_table = make_base64_decoding_table();
+
+    auto decode_quads_scalar(const char* input, size_t nr_chars, std::uint8_t* output) noexcept -> size_t {
+        size_t i = 0;
+        for (; i < nr_chars; i += 4) {
+            const auto decoded_a = base64_decoding_table[static_cast<unsigned char>(input[i])];
+            const auto decoded_b = base64_decoding_table[static_cast<unsigned char>(input[i + 1])];
+            const auto decoded_c = base64_decoding_table[static_cast<unsigned char>(input[i + 2])];
+            const auto decoded_d = base64_decoding_table[static_cast<unsigned char>(input[i + 3])];
+            // valid values are below 64, so the top bits are only set by invalid characters
+            if (((decoded_a | decoded_b | decoded_c | decoded_d) & 0xC0) != 0) {
+                break;
+            }
+            output[0] = static_cast<std::uint8_t>((decoded_a << 2) | (decoded_b >> 4));
+            output[1] = static_cast<std::uint8_t>(((decoded_b & 0x0F) << 4) | (decoded_c >> 2));
+            output[2] = static_cast<std::uint8_t>(((decoded_c & 0x03) << 6) | decoded_d);
+            output += 3;
+        }
+        return i;
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    // The vectorised decoders follow W. Muła and D. Lemire, "Faster Base64 Encoding and
+    // Decoding using AVX2 Instructions". Characters are classified by their high and low
+    // nibbles with two table lookups (pshufb): one table says which high nibbles are
+    // valid for a given low nibble, another gives the offset to add to turn the character
+    // into its 6 bits value. Groups of four 6 bits values are then packed into three bytes
+    // with two multiply-add and a final shuffle.
+    //
+    // Blocks are stored with full width stores, writing a few bytes past the decoded ones.
+    // The loops therefore stop early enough for those bytes to still be within output, and
+    // the scalar decoder finishes the job.
+
+    __attribute__((target("sse4.1")))
+    auto decode_quads_sse41(const char* input, size_t nr_chars, std::uint8_t* output) noexcept -> size_t {
+        const auto shift_lut = _mm_setr_epi8(0, 0, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+        const auto mask_lut = _mm_setr_epi8(
+                /* 0        */ static_cast<char>(0xa8),
+                /* 1 .. 9   */ static_cast<char>(0xf8), static_cast<char>(0xf8), static_cast<char>(0xf8),
+                                 static_cast<char>(0xf8), static_cast<char>(0xf8), static_cast<char>(0xf8),
+                                 static_cast<char>(0xf8), static_cast<char>(0xf8), static_cast<char>(0xf8),
+                /* 10       */ static_cast<char>(0xf0),
+                /* 11       */ 0x54,
+                /* 12 .. 14 */ 0x50, 0x50, 0x50,
+                /* 15       */ 0x54);
+        const auto bitpos_lut = _mm_setr_epi8(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, static_cast<char>(0x80),
+                                              0, 0, 0, 0, 0, 0, 0, 0);
+        const auto pack_shuffle = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+        size_t i = 0;
+        for (; i + 24 <= nr_chars; i += 16) {
+            const auto chars = _mm_loadu_si128(reinterpret_cast<const __m128i_u*>(input + i));
+            const auto high_nibbles = _mm_and_si128(_mm_srli_epi32(chars, 4), _mm_set1_epi8(0x0f));
+            const auto low_nibbles = _mm_and_si128(chars, _mm_set1_epi8(0x0f));
+
+            const auto valid_high_nibbles = _mm_shuffle_epi8(mask_lut, low_nibbles);
+            const auto high_nibble_bit = _mm_shuffle_epi8(bitpos_lut, high_nibbles);
+            const auto is_invalid = _mm_cmpeq_epi8(_mm_and_si128(valid_high_nibbles, high_nibble_bit), _mm_setzero_si128());
+            if (_mm_movemask_epi8(is_invalid) != 0) {
+                break;
+            }
+
+            // '/' shares its high nibble with '+' but needs a different offset
+            const auto is_slash = _mm_cmpeq_epi8(chars, _mm_set1_epi8('/'));
+            const auto shift = _mm_blendv_epi8(_mm_shuffle_epi8(shift_lut, high_nibbles), _mm_set1_epi8(16), is_slash);
+            const auto values = _mm_add_epi8(chars, shift);
+
+            const auto merged_pairs = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+            const auto merged_quads = _mm_madd_epi16(merged_pairs, _mm_set1_epi32(0x00011000));
+            const auto packed = _mm_shuffle_epi8(merged_quads, pack_shuffle);
+            _mm_storeu_si128(reinterpret_cast<__m128i_u*>(output + (i / 4) * 3), packed);
+        }
+        return i + decode_quads_scalar(input + i, nr_chars - i, output + (i / 4) * 3);
+    }
+
+    __attribute__((target("avx2")))
+    auto decode_quads_avx2(const char* input, size_t nr_chars, std::uint8_t* output) noexcept -> size_t {
+        const auto shift_lut = _mm256_setr_epi8(0, 0, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+                                                0, 0, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+        const auto mask_lut = _mm256_setr_epi8(
+                static_cast<char>(0xa8),
+                static_cast<char>(0xf8), static_cast<char>(0xf8), static_cast<char>(0xf8),
+                static_cast<char>(0xf8), static_cast<char>(0xf8), static_cast<char>(0xf8),
+                static_cast<char>(0xf8), static_cast<char>(0xf8), static_cast<char>(0xf8),
+                static_cast<char>(0xf0), 0x54, 0x50, 0x50, 0x50, 0x54,
+                static_cast<char>(0xa8),
+                static_cast<char>(0xf8), static_cast<char>(0xf8), static_cast<char>(0xf8),
+                static_cast<char>(0xf8), static_cast<char>(0xf8), static_cast<char>(0xf8),
+                static_cast<char>(0xf8), static_cast<char>(0xf8), static_cast<char>(0xf8),
+                static_cast<char>(0xf0), 0x54, 0x50, 0x50, 0x50, 0x54);
+        const auto bitpos_lut = _mm256_setr_epi8(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, static_cast<char>(0x80),
+                                                 0, 0, 0, 0, 0, 0, 0, 0,
+                                                 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, static_cast<char>(0x80),
+                                                 0, 0, 0, 0, 0, 0, 0, 0);
+        // pshufb works within 128 bits lanes: each lane packs its 12 bytes, then the two
+        // halves are moved next to each other
+        const auto pack_shuffle = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                                   2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+        const auto pack_lanes = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+
+        size_t i = 0;
+        for (; i + 48 <= nr_chars; i += 32) {
+            const auto chars = _mm256_loadu_si256(reinterpret_cast<const __m256i_u*>(input + i));
+            const auto high_nibbles = _mm256_and_si256(_mm256_srli_epi32(chars, 4), _mm256_set1_epi8(0x0f));
+            const auto low_nibbles = _mm256_and_si256(chars, _mm256_set1_epi8(0x0f));
+
+            const auto valid_high_nibbles = _mm256_shuffle_epi8(mask_lut, low_nibbles);
+            const auto high_nibble_bit = _mm256_shuffle_epi8(bitpos_lut, high_nibbles);
+            const auto is_invalid = _mm256_cmpeq_epi8(_mm256_and_si256(valid_high_nibbles, high_nibble_bit), _mm256_setzero_si256());
+            if (_mm256_movemask_epi8(is_invalid) != 0) {
+                break;
+            }
+
+            const auto is_slash = _mm256_cmpeq_epi8(chars, _mm256_set1_epi8('/'));
+            const auto shift = _mm256_blendv_epi8(_mm256_shuffle_epi8(shift_lut, high_nibbles), _mm256_set1_epi8(16), is_slash);
+            const auto values = _mm256_add_epi8(chars, shift);
+
+            const auto merged_pairs = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+            const auto merged_quads = _mm256_madd_epi16(merged_pairs, _mm256_set1_epi32(0x00011000));
+            const auto packed = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(merged_quads, pack_shuffle), pack_lanes);
+            _mm256_storeu_si256(reinterpret_cast<__m256i_u*>(output + (i / 4) * 3), packed);
+        }
+        // the rest runs legacy SSE code, which is very slow while the upper halves of the ymm
+        // registers are dirty. The compiler doesn't always clear them by itself.
+        _mm256_zeroupper();
+        return i + decode_quads_sse41(input + i, nr_chars - i, output + (i / 4) * 3);
+    }
+#endif
+
+    auto select_quad_decoder() noexcept -> base64_quad_decode_fn {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return decode_quads_avx2;
+        }
+        if (__builtin_cpu_supports("sse4.1")) {
+            return decode_quads_sse41;
+        }
+#endif
+        return decode_quads_scalar;
+    }
 }
 
 namespace {
-    auto base64_decode_c(const unsigned char c) -> std::uint8_t {
-        if (('A' <= c) && (c <= 'Z')) {
-            return static_cast<std::uint8_t>(c - 'A');
+    auto invalid_char_error(const unsigned char c) -> std::unexpected<std::string> {
+        return std::unexpected(std::format("Can't decode character {} as base64", c));
+    }
+
+    // Characters after the last complete group of 4 are ignored, unless the padding says
+    // there are 2 or 3 of them. Those are decoded separately as the tail.
+    struct base64_layout {
+        size_t nr_quad_chars; // characters decoded in groups of 4
+        size_t nr_padding;
+
+        auto nr_tail_bytes() const noexcept -> size_t {
+            return (nr_padding == 0) ? 0 : 3 - nr_padding;
         }
-        if (('a' <= c) && (c <= 'z')) {
-            return 26 + static_cast<std::uint8_t>(c - 'a');
+
+        auto decoded_size() const noexcept -> size_t {
+            return (nr_quad_chars / 4) * 3 + nr_tail_bytes();
         }
-        if (('0' <= c) && (c <= '9')) {
-            return 52 + static_cast<std::uint8_t>(c - '0');
+    };
+
+    // input must not be empty
+    auto get_layout(std::string_view input) -> std::expected<base64_layout, std::string> {
+        const auto nr_chars = input.size();
+        if (nr_chars < 2) {
+            return std::unexpected(std::format("Not enough characters to do base64 decoding. At least 2 required"));
         }
-        if (c == '+') {
-            return 62;
+        size_t nr_padding = 0;
+        if (input[nr_chars - 1] == '=') {
+            nr_padding += 1;
         }
-        if (c == '/') {
-            return 63;
+        if (input[nr_chars - 2] == '=') {
+            nr_padding += 1;
         }
-        throw std::invalid_argument(std::format("Can't decode character {} as base64", c));
+        const auto nr_chars_without_padding = nr_chars - nr_padding;
+        return base64_layout{
+            .nr_quad_chars = nr_chars_without_padding - (nr_chars_without_padding % 4),
+            .nr_padding = nr_padding,
+        };
+    }
+
+    // input.size() must be a multiple of 4, output must be 3 * input.size() / 4 bytes long
+    auto decode_quads_checked(std::string_view input, std::uint8_t* output) -> std::expected<void, std::string> {
+        static const auto decode_quads = select_quad_decoder();
+
+        const auto nr_decoded_chars = decode_quads(input.data(), input.size(), output);
+        if (nr_decoded_chars == input.size()) {
+            return {};
+        }
+        // the decoder stopped at the first group containing an invalid character
+        for (size_t i = nr_decoded_chars; i < nr_decoded_chars + 4; ++i) {
+            const auto c = static_cast<unsigned char>(input[i]);
+            if (base64_decoding_table[c] == invalid_base64_char) {
+                return invalid_char_error(c);
+            }
+        }
+        __builtin_unreachable();
+    }
+
+    // output must be layout.nr_tail_bytes() long
+    auto decode_tail(std::string_view input, const base64_layout& layout, std::uint8_t* output) -> std::expected<void, std::string> {
+        const auto nr_chars = layout.nr_tail_bytes() + 1;
+        if (nr_chars == 1) {
+            return {};
+        }
+        std::array<std::uint8_t, 3> decoded = {};
+        for (size_t i = 0; i < nr_chars; ++i) {
+            const auto c = static_cast<unsigned char>(input[layout.nr_quad_chars + i]);
+            decoded[i] = base64_decoding_table[c];
+            if (decoded[i] == invalid_base64_char) {
+                return invalid_char_error(c);
+            }
+        }
+        output[0] = static_cast<std::uint8_t>((decoded[0] << 2) | (decoded[1] >> 4));
+        if (nr_chars == 3) {
+            output[1] = static_cast<std::uint8_t>(((decoded[1] & 0x0F) << 4) | (decoded[2] >> 2));
+        }
+        return {};
     }
 }
 
-#include <iostream>
-auto base64_decode(const std::string_view& input) -> std::vector<std::uint8_t> {
-    std::vector<std::uint8_t> res;
-    const auto nr_chars = input.size();
-    if (nr_chars == 0) {
+auto base64_quad_decoders() -> std::vector<base64_quad_decoder> {
+    std::vector<base64_quad_decoder> res = {{.name = "scalar", .decode = decode_quads_scalar}};
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.1")) {
+        res.push_back({.name = "sse4.1", .decode = decode_quads_sse41});
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        res.push_back({.name = "avx2", .decode = decode_quads_avx2});
+    }
+#endif
+    return res;
+}
+
+auto base64_decoded_size(std::string_view input) noexcept -> size_t {
+    if (input.size() < 2) {
+        return 0;
+    }
+    // can't fail with at least 2 characters
+    return get_layout(input)->decoded_size();
+}
+
+auto base64_decode_into(std::string_view input, std::span<std::uint8_t> dest) -> std::expected<void, std::string> {
+    if (input.empty()) {
         return {}; // empty string means empty data
     }
-    if (nr_chars < 2) {
-        throw std::invalid_argument(std::format("Not enough characters to do base64 decoding. At least 2 required"));
-    }
-    size_t nr_padding = 0;
-    if (input[nr_chars - 1] == '=') {
-        nr_padding += 1;
-    }
-    if (input[nr_chars - 2] == '=') {
-        nr_padding += 1;
-    }
-
-    const auto nr_chars_without_padding = nr_chars - nr_padding;
-    res.reserve((nr_chars_without_padding + 3) / 4); // +3  for ceiling
-
-    unsigned i;
-    for (i = 0; i + 3 < nr_chars_without_padding; i += 4) {
-        const auto a = static_cast<unsigned char>(input[i]);
-        const auto b = static_cast<unsigned char>(input[ i + 1 ]);
-        const auto c = static_cast<unsigned char>(input[ i + 2 ]);
-        const auto d = static_cast<unsigned char>(input[ i + 3 ]);
-
-        const auto decoded_a = base64_decode_c(a);
-        const auto decoded_b = base64_decode_c(b);
-        const auto decoded_c = base64_decode_c(c);
-        const auto decoded_d = base64_decode_c(d);
-
-        const auto byte_1 = static_cast<uint8_t>((decoded_a << 2) | (decoded_b >> 4));
-        const auto byte_2 = static_cast<uint8_t>(((decoded_b & 0x0F) << 4) | (decoded_c >> 2));
-        const auto byte_3 = static_cast<uint8_t>(((decoded_c & 0x03) << 6) | decoded_d);
-
-        res.push_back(byte_1);
-        res.push_back(byte_2);
-        res.push_back(byte_3);
-    }
-    switch (nr_padding) {
-        case 0:
-            break;
-        case 1: {
-            // two more bytes
-            const auto a = static_cast<unsigned char>(input[i]);
-            const auto b = static_cast<unsigned char>(input[ i + 1 ]);
-            const auto c = static_cast<unsigned char>(input[ i + 2 ]);
-
-            const auto decoded_a = base64_decode_c(a);
-            const auto decoded_b = base64_decode_c(b);
-            const auto decoded_c = base64_decode_c(c);
-
-            const auto byte_1 = static_cast<uint8_t>((decoded_a << 2) | (decoded_b >> 4));
-            const auto byte_2 = static_cast<uint8_t>(((decoded_b & 0x0F) << 4) | (decoded_c >> 2));
-            res.push_back(byte_1);
-            res.push_back(byte_2);
-            break;
-        };
-        case 2: {
-            // one more byte
-            const auto a = static_cast<unsigned char>(input[i]);
-            const auto b = static_cast<unsigned char>(input[ i + 1 ]);
+    const auto layout = get_layout(input);
+    if (!layout.has_value()) {
+        return std::unexpected(layout.error());
+    }
+    if (dest.size() != layout->decoded_size()) {
+        return std::unexpected(std::format("Base64 decoding needs a buffer of {} bytes, got {}", layout->decoded_size(), dest.size()));
+    }
+    if (auto decoded = decode_quads_checked(input.substr(0, layout->nr_quad_chars), dest.data()); !decoded.has_value()) {
+        return decoded;
+    }
+    return decode_tail(input, layout.value(), dest.data() + (layout->nr_quad_chars / 4) * 3);
+}
 
-            const auto decoded_a = base64_decode_c(a);
-            const auto decoded_b = base64_decode_c(b);
+auto base64_decode_chunks(std::string_view input, size_t max_chunk_size, const base64_chunk_sink& on_chunk) -> std::expected<void, std::string> {
+    if (input.empty()) {
+        return {};
+    }
+    const auto layout = get_layout(input);
+    if (!layout.has_value()) {
+        return std::unexpected(layout.error());
+    }
 
-            const auto byte_1 = static_cast<uint8_t>((decoded_a << 2) | (decoded_b >> 4));
-            res.push_back(byte_1);
-            break;
-        };
-        default:
-            __builtin_unreachable();
+    const auto nr_chars_per_chunk = std::max(max_chunk_size / 3, size_t{1}) * 4;
+    std::vector<std::uint8_t> chunk(std::min(nr_chars_per_chunk, layout->nr_quad_chars) / 4 * 3);
+    for (size_t pos = 0; pos < layout->nr_quad_chars; pos += nr_chars_per_chunk) {
+        const auto chars = input.substr(pos, std::min(nr_chars_per_chunk, layout->nr_quad_chars - pos));
+        const auto decoded = std::span(chunk).first(chars.size() / 4 * 3);
+        if (auto res = decode_quads_checked(chars, decoded.data()); !res.has_value()) {
+            return res;
+        }
+        if (auto res = on_chunk(decoded); !res.has_value()) {
+            return res;
+        }
+    }
+
+    std::array<std::uint8_t, 2> tail = {};
+    const auto decoded_tail = std::span(tail).first(layout->nr_tail_bytes());
+    if (auto res = decode_tail(input, layout.value(), decoded_tail.data()); !res.has_value()) {
+        return res;
+    }
+    if (decoded_tail.empty()) {
+        return {};
+    }
+    return on_chunk(decoded_tail);
+}
+
+auto base64_decode_to_fd(std::string_view input, int fd) -> std::expected<void, std::string> {
+    // big enough to make syscalls cost nothing, small enough to not matter memory wise
+    constexpr size_t chunk_size = size_t{1024} * 1024;
+    return base64_decode_chunks(input, chunk_size, [fd](std::span<const std::uint8_t> data) {
+        return write_all(fd, data);
+    });
+}
+
+auto base64_decode(std::string_view input) -> std::expected<std::vector<std::uint8_t>, std::string> {
+    std::vector<std::uint8_t> res(base64_decoded_size(input));
+    if (auto decoded = base64_decode_into(input, res); !decoded.has_value()) {
+        return std::unexpected(std::move(decoded.error()));
     }
     return res;
 }
+
+auto write_all(int fd, std::span<const std::uint8_t> data) -> std::expected<void, std::string> {
+    while (!data.empty()) {
+        const auto nr_written_bytes = write(fd, data.data(), data.size());
+        if (nr_written_bytes == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return std::unexpected(std::format("write failed. Err is {}: {}", errno, strerror(errno)));
+        }
+        data = data.subspan(static_cast<size_t>(nr_written_bytes));
+    }
+    return {};
+}
@@ -1,8 +1,66 @@
 #pragma once
 
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <functional>
+#include <span>
 #include <string>
 #include <string_view>
 #include <vector>
 
-bool is_issue_before(const std::string& a, const std::string& b);
-auto base64_decode(const std::string_view& input) -> std::vector<std::uint8_t>;
+// Base64 decoding. Errors are returned, never thrown, so callers decoding replies don't need
+// to guard every call with a try block.
+
+// number of bytes input decodes to. Only meaningful when input is valid base64.
+auto base64_decoded_size(std::string_view input) noexcept -> size_t;
+// dest must be exactly base64_decoded_size(input) bytes long, for example a QByteArray created
+// with that size. Its content is unspecified on error.
+auto base64_decode_into(std::string_view input, std::span<std::uint8_t> dest) -> std::expected<void, std::string>;
+
+// Decodes input piece by piece, handing each piece over to the sink as soon as it is decoded, so
+// at most max_chunk_size decoded bytes are held in memory. Stops at the first error, be it an
+// invalid character or an error returned by the sink. Pieces handed over before an error are
+// not taken back.
+using base64_chunk_sink = std::function<std::expected<void, std::string>(std::span<const std::uint8_t>)>;
+auto base64_decode_chunks(std::string_view input, size_t max_chunk_size, const base64_chunk_sink& on_chunk) -> std::expected<void, std::string>;
+// writes the decoded data to fd, chunk by chunk
+auto base64_decode_to_fd(std::string_view input, int fd) -> std::expected<void, std::string>;
+
+auto base64_decode(std::string_view input) -> std::expected<std::vector<std::uint8_t>, std::string>;
+
+// The decoders base64_decode_into picks from, exposed so that they can be checked against each
+// other (see jira_gui_bench --check). A decoder decodes nr_chars characters (a multiple of 4)
+// from input into 3 * nr_chars / 4 bytes of output. It stops at the first group of 4
+// characters containing an invalid one, and returns the number of characters decoded.
+using base64_quad_decode_fn = auto (*)(const char* input, size_t nr_chars, std::uint8_t* output) noexcept -> size_t;
+struct base64_quad_decoder {
+    std::string_view name;
+    base64_quad_decode_fn decode;
+};
+// the ones the cpu supports, the scalar one first
+auto base64_quad_decoders() -> std::vector<base64_quad_decoder>;
+
+// retries on EINTR until everything is written, fd must be blocking
+auto write_all(int fd, std::span<const std::uint8_t> data) -> std::expected<void, std::string>;
+
+// Integers of the binary frames and of the files written by the application are little endian,
+// whatever the byte order of the host.
+template <std::unsigned_integral T>
+void append_le(std::string& dest, T value) {
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        dest += static_cast<char>((value >> (8 * i)) & 0xFF);
+    }
+}
+
+// data must point to at least sizeof(T) bytes
+template <std::unsigned_integral T>
+auto load_le(const void* data) noexcept -> T {
+    const auto* const bytes = static_cast<const std::uint8_t*>(data);
+    T res = 0;
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        res = static_cast<T>(res | (static_cast<T>(bytes[i]) << (8 * i)));
+    }
+    return res;
+}
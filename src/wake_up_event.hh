@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+// Thin wrapper around an eventfd. Its file descriptor can be added to a poll set so that
+// a thread sleeping in poll can be woken up from another thread, e.g. when a stop is requested.
+class wake_up_event final {
+public:
+    wake_up_event() noexcept
+        : fd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK))
+    {
+    }
+
+    wake_up_event(const wake_up_event&) = delete;
+    wake_up_event& operator=(const wake_up_event&) = delete;
+
+    ~wake_up_event() noexcept {
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+
+    auto is_valid() const noexcept -> bool {
+        return fd != -1;
+    }
+
+    auto get_fd() const noexcept -> int {
+        return fd;
+    }
+
+    // can be called from any thread, any number of times
+    void signal() const noexcept {
+        const std::uint64_t one = 1;
+        [[maybe_unused]] const auto write_ret = write(fd, &one, sizeof(one));
+    }
+
+    // resets the event so that poll doesn't report it as readable anymore
+    void clear() const noexcept {
+        std::uint64_t counter;
+        [[maybe_unused]] const auto read_ret = read(fd, &counter, sizeof(counter));
+    }
+
+private:
+    int fd;
+};